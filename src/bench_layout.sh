@@ -0,0 +1,65 @@
+#!/usr/bin/env bash
+#
+# Compare the split and grouped table layouts on the same trace:
+#
+#   ./bench_layout.sh [<trace> [<config>]]
+#
+# Runs the predictor once with each layout under --perf and prints the
+# task clock, L1D read misses and LLC misses per branch side by side.
+# A text or bzip2 trace is first converted to a binary one, so that the
+# counts are of the predictor rather than of decoding. The default is
+# ../traces/parest.bz2 with custom:24:16:24, whose tables are larger
+# than the caches.
+
+set -e
+
+trace=${1:-../traces/parest.bz2}
+name=$trace
+config=${2:-custom:24:16:24}
+dir=$(dirname "$0")
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+case "$trace" in
+  *.bpt) ;;
+  *)
+    "$dir/trace_convert" "$trace" "$tmp/trace.bpt" > /dev/null
+    trace=$tmp/trace.bpt
+    ;;
+esac
+
+for layout in split grouped; do
+  "$dir/predictor" --$config --layout=$layout --perf "$trace" > "$tmp/$layout"
+done
+
+# Per-branch value of an event, or "unavailable"
+per_branch() {
+  awk -v event="$1" 'index($0, event) == 1 {
+    $0 = substr($0, length(event) + 1)
+    print ($1 == "unavailable") ? "unavailable" : $2
+  }' "$tmp/$2"
+}
+
+echo "Trace:  $name"
+echo "Config: $config"
+printf "%-26s %14s %14s\n" "Per branch" "split" "grouped"
+missing=0
+for event in "Task clock (ns)" "L1D read misses" "LLC misses"; do
+  split=$(per_branch "$event" split)
+  grouped=$(per_branch "$event" grouped)
+  printf "%-26s %14s %14s\n" "$event" "$split" "$grouped"
+  if [ "$split" = unavailable ] || [ "$grouped" = unavailable ]; then
+    missing=1
+  fi
+done
+
+if ! cmp -s <(grep -v '^Event' "$tmp/split" | head -3) <(grep -v '^Event' "$tmp/grouped" | head -3); then
+  echo "The two layouts predicted differently"
+  exit 1
+fi
+if [ $missing -ne 0 ]; then
+  echo "Cache miss counters are unavailable on this machine (no hardware"
+  echo "perf events, or perf_event_paranoid forbids them): only the task"
+  echo "clock is compared."
+fi
@@ -0,0 +1,187 @@
+//========================================================//
+//  bzip2_blocks.cpp                                      //
+//  Source file for splitting bzip2 files into blocks     //
+//                                                        //
+//  Each block is re-wrapped into a one-block stream so   //
+//  that blocks can be decompressed on separate threads   //
+//========================================================//
+#include <stdlib.h>
+#include <string.h>
+#include <bzlib.h>
+#include "bzip2_blocks.h"
+
+// 48-bit magics in front of every block and at the end of a stream
+#define BLOCK_MAGIC 0x314159265359ULL
+#define EOS_MAGIC 0x177245385090ULL
+#define MAGIC_MASK 0xFFFFFFFFFFFFULL
+
+//------------------------------------//
+//          Bit Level Helpers         //
+//------------------------------------//
+
+// Read 'n' (<= 32) bits starting at bit 'pos' (MSB first)
+//
+static uint32_t get_bits(const uint8_t *data, uint64_t pos, int n)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < n; i++, pos++)
+  {
+    value = (value << 1) | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+  }
+  return value;
+}
+
+typedef struct
+{
+  uint8_t *out;
+  uint64_t pos; // in bits
+} bit_writer;
+
+static void put_bits(bit_writer *w, uint64_t value, int n)
+{
+  for (int i = n - 1; i >= 0; i--, w->pos++)
+  {
+    if ((value >> i) & 1)
+    {
+      w->out[w->pos >> 3] |= 0x80 >> (w->pos & 7);
+    }
+  }
+}
+
+// Copy bits [start, end) of 'data', a byte at a time where possible
+//
+static void copy_bits(bit_writer *w, const uint8_t *data, uint64_t start, uint64_t end)
+{
+  while (start < end && (start & 7) != 0)
+  {
+    put_bits(w, get_bits(data, start, 1), 1);
+    start++;
+  }
+  while (end - start >= 8)
+  {
+    put_bits(w, data[start >> 3], 8);
+    start += 8;
+  }
+  if (start < end)
+  {
+    put_bits(w, get_bits(data, start, end - start), end - start);
+  }
+}
+
+//------------------------------------//
+//          Block Functions           //
+//------------------------------------//
+
+long bz2_find_blocks(const uint8_t *data, size_t size, bz2_block **blocks)
+{
+  if (size < 4 || memcmp(data, "BZh", 3) != 0)
+  {
+    return -1;
+  }
+
+  long count = 0;
+  long capacity = 64;
+  *blocks = (bz2_block *)malloc(capacity * sizeof(bz2_block));
+
+  // Slide a 64-bit window over the file and test the 48 bits ending
+  // at each bit position for one of the two magics
+  uint64_t window = 0;
+  for (size_t byte = 0; byte < size; byte++)
+  {
+    window = (window << 8) | data[byte];
+    if (byte < 5)
+    {
+      continue;
+    }
+    for (int shift = 7; shift >= 0; shift--)
+    {
+      uint64_t bits = (window >> shift) & MAGIC_MASK;
+      if (bits != BLOCK_MAGIC && bits != EOS_MAGIC)
+      {
+        continue;
+      }
+
+      // Bit position where the magic begins
+      uint64_t pos = (byte + 1) * 8 - shift - 48;
+      if (count > 0 && (*blocks)[count - 1].end_bit == 0)
+      {
+        (*blocks)[count - 1].end_bit = pos;
+      }
+      if (bits == BLOCK_MAGIC)
+      {
+        if (count == capacity)
+        {
+          capacity *= 2;
+          *blocks = (bz2_block *)realloc(*blocks, capacity * sizeof(bz2_block));
+        }
+        (*blocks)[count].start_bit = pos;
+        (*blocks)[count].end_bit = 0;
+        count++;
+      }
+    }
+  }
+
+  // A truncated file leaves its last block open
+  if (count > 0 && (*blocks)[count - 1].end_bit == 0)
+  {
+    count--;
+  }
+  return count;
+}
+
+int bz2_decode_block(const uint8_t *data, const bz2_block *block, char **text, size_t *size)
+{
+  // Build "BZh9" + block + end-of-stream magic + stream CRC. With a
+  // single block the stream CRC equals the block CRC, which directly
+  // follows the block magic.
+  uint64_t nbits = block->end_bit - block->start_bit;
+  size_t stream_size = 4 + (nbits + 7) / 8 + 6 + 4 + 1;
+  uint8_t *stream = (uint8_t *)calloc(stream_size, 1);
+  memcpy(stream, "BZh9", 4);
+
+  bit_writer w = {stream, 32};
+  copy_bits(&w, data, block->start_bit, block->end_bit);
+  put_bits(&w, EOS_MAGIC, 48);
+  put_bits(&w, get_bits(data, block->start_bit + 48, 32), 32);
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK)
+  {
+    free(stream);
+    return 0;
+  }
+  strm.next_in = (char *)stream;
+  strm.avail_in = (w.pos + 7) / 8;
+
+  size_t capacity = 1 << 20;
+  size_t filled = 0;
+  char *out = (char *)malloc(capacity + 1 + BZ2_TEXT_PADDING);
+  int ret;
+  do
+  {
+    if (filled == capacity)
+    {
+      capacity *= 2;
+      out = (char *)realloc(out, capacity + 1 + BZ2_TEXT_PADDING);
+    }
+    strm.next_out = out + filled;
+    strm.avail_out = capacity - filled;
+    ret = BZ2_bzDecompress(&strm);
+    filled = capacity - strm.avail_out;
+  } while (ret == BZ_OK && (strm.avail_in > 0 || strm.avail_out == 0));
+
+  BZ2_bzDecompressEnd(&strm);
+  free(stream);
+
+  if (ret != BZ_STREAM_END)
+  {
+    free(out);
+    return 0;
+  }
+
+  out[filled] = '\0';
+  *text = out;
+  *size = filled;
+  return 1;
+}
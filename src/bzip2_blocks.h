@@ -0,0 +1,41 @@
+//========================================================//
+//  bzip2_blocks.h                                        //
+//  Header file for splitting bzip2 files into their      //
+//  independently decodable compressed blocks             //
+//========================================================//
+
+#ifndef BZIP2_BLOCKS_H
+#define BZIP2_BLOCKS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Readable bytes after the text returned by bz2_decode_block
+#define BZ2_TEXT_PADDING 64
+
+// A compressed block, as a range of bits of the bzip2 file that
+// starts with the block magic and ends just before the next block
+// or end-of-stream magic
+//
+typedef struct
+{
+  uint64_t start_bit;
+  uint64_t end_bit;
+} bz2_block;
+
+// Find all compressed blocks of the (possibly multi-stream) bzip2
+// file in data[0, size). '*blocks' is malloc'd by the callee.
+//
+// Returns the number of blocks, or -1 if 'data' is not bzip2
+//
+long bz2_find_blocks(const uint8_t *data, size_t size, bz2_block **blocks);
+
+// Decompress a single block on its own. '*text' is malloc'd by the
+// callee and holds '*size' bytes plus a terminating NUL, followed by
+// BZ2_TEXT_PADDING readable bytes for block scanners.
+//
+// Returns True if Successful
+//
+int bz2_decode_block(const uint8_t *data, const bz2_block *block, char **text, size_t *size);
+
+#endif
@@ -0,0 +1,111 @@
+//========================================================//
+//  counters.h                                            //
+//  Header file for tables of saturating counters packed  //
+//  into 64-bit words                                     //
+//                                                        //
+//  A BITS-bit counter predicts taken in its upper half;  //
+//  for BITS = 2 the values are SN, WN, WT and ST         //
+//========================================================//
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Bytes in a cache line
+#define COUNTER_LINE 64
+
+template <int BITS>
+class CounterArray
+{
+  static_assert(BITS >= 1 && BITS <= 8, "counters are 1 to 8 bits wide");
+
+public:
+  static const int PER_WORD = 64 / BITS; // no counter straddles two words
+  static const uint64_t MAX = (1ULL << BITS) - 1;
+  static const uint64_t TAKEN_MIN = 1ULL << (BITS - 1);
+
+  uint64_t *words;
+
+  // Bytes taken by a table of 'entries' counters, in whole cache
+  // lines
+  //
+  static uint64_t bytes(uint64_t entries)
+  {
+    uint64_t words = (entries + PER_WORD - 1) / PER_WORD;
+    return (words * sizeof(uint64_t) + COUNTER_LINE - 1) / COUNTER_LINE * COUNTER_LINE;
+  }
+
+  // Allocate 'entries' counters set to 'value', starting on a cache
+  // line
+  //
+  void init(uint64_t entries, uint64_t value)
+  {
+    uint64_t word = 0;
+    for (int i = 0; i < PER_WORD; i++)
+    {
+      word |= value << (i * BITS);
+    }
+    uint64_t num_words = bytes(entries) / sizeof(uint64_t);
+    words = (uint64_t *)aligned_alloc(COUNTER_LINE, num_words * sizeof(uint64_t));
+    for (uint64_t i = 0; i < num_words; i++)
+    {
+      words[i] = word;
+    }
+  }
+
+  void release()
+  {
+    free(words);
+    words = NULL;
+  }
+
+  uint64_t get(uint64_t i) const
+  {
+    return (words[i / PER_WORD] >> ((i % PER_WORD) * BITS)) & MAX;
+  }
+
+  void set(uint64_t i, uint64_t value)
+  {
+    uint64_t *word = &words[i / PER_WORD];
+    int shift = (i % PER_WORD) * BITS;
+    *word = (*word & ~(MAX << shift)) | (value << shift);
+  }
+
+  // Start loading the line of counter 'i' ahead of an update
+  //
+  void prefetch(uint64_t i) const
+  {
+    __builtin_prefetch(&words[i / PER_WORD], 1);
+  }
+
+  static int taken(uint64_t value)
+  {
+    return value >= TAKEN_MIN;
+  }
+
+  // 'value' moved one step towards 'outcome', saturating, without
+  // branches
+  //
+  static uint64_t next(uint64_t value, uint32_t outcome)
+  {
+    return value + ((outcome != 0) & (value != MAX)) - ((outcome == 0) & (value != 0));
+  }
+
+  // Move counter 'i' one step towards 'outcome'
+  //
+  // Returns its previous value
+  //
+  uint64_t step(uint64_t i, uint32_t outcome)
+  {
+    uint64_t *word = &words[i / PER_WORD];
+    int shift = (i % PER_WORD) * BITS;
+    uint64_t value = (*word >> shift) & MAX;
+    // The difference is 0 or +-1, added modulo 2^64
+    *word += (next(value, outcome) - value) << shift;
+    return value;
+  }
+};
+
+#endif
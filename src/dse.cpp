@@ -0,0 +1,350 @@
+//========================================================//
+//  dse.cpp                                               //
+//  Source file for the design-space exploration and      //
+//  tuning drivers                                        //
+//                                                        //
+//  The design space is a grid of table sizes per type;   //
+//  candidates run in groups sharing one trace pass       //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "predictor.h"
+#include "simulate.h"
+#include "dse.h"
+
+// Configurations simulated together on one pass over a trace
+#define DSE_GROUP 16
+
+// Sizes explored for each parameter
+static const int gshareBits[] = {4, 6, 8, 10, 11, 12, 13, 14, 15, 16, 17};
+static const int tournamentGlobal[] = {8, 10, 12, 13, 14, 15, 16};
+static const int tournamentLocal[] = {8, 10, 12, 14, 16};
+static const int tournamentChooser[] = {8, 10, 12, 14, 16};
+static const int customGlobal[] = {12, 13, 14, 15, 16};
+static const int customLocal[] = {10, 12, 14, 15};
+static const int customChooser[] = {10, 12, 14, 16};
+static const int customHistory[] = {5, 16, 31};
+static const int customPerceptrons[] = {5, 128};
+static const int tageBase[] = {12, 14};
+static const int tageTableCounts[] = {4, 7, 10};
+static const int tageTableSizes[] = {9, 10, 11};
+static const int tageTags[] = {9, 11};
+static const int tageHistories[] = {64, 200, 640};
+static const int perceptronTableCounts[] = {8, 15, 30};
+static const int perceptronTableSizes[] = {9, 10, 11};
+static const int perceptronHistories[] = {64, 300, 1024};
+static const int piecewiseAddrs[] = {3, 5, 7};
+static const int piecewisePaths[] = {3, 5, 7};
+static const int piecewiseHistories[] = {16, 31, 64};
+static const int yagsChoice[] = {10, 12, 14};
+static const int yagsSets[] = {6, 8, 10};
+static const int yagsTags[] = {6, 8};
+static const int yagsWayCounts[] = {1, 2, 4};
+static const int bimodeChoice[] = {10, 12, 13, 14, 15, 16};
+static const int bimodeDirection[] = {10, 12, 13, 14, 15};
+
+#define COUNT(a) (int)(sizeof(a) / sizeof(a[0]))
+
+typedef struct
+{
+  char *config;
+  uint64_t bits;
+  double mean;
+  double geomean;
+} dse_point;
+
+static dse_point *points;
+static int num_points, points_capacity;
+
+// Add 'config' to the design space if it fits in 'budget'
+//
+static void add_point(const char *config, uint64_t budget)
+{
+  load_predictor(&default_config);
+  parse_config(config);
+  uint64_t bits = predictor_storage_bits();
+  if (bits > budget)
+  {
+    return;
+  }
+  if (num_points == points_capacity)
+  {
+    points_capacity = points_capacity ? 2 * points_capacity : 256;
+    points = (dse_point *)realloc(points, points_capacity * sizeof(dse_point));
+  }
+  points[num_points].mean = 0;
+  points[num_points].geomean = 0;
+  points[num_points].config = strdup(config);
+  points[num_points].bits = bits;
+  num_points++;
+}
+
+static void enumerate(int type, uint64_t budget)
+{
+  char config[64];
+  if (type < 0 || type == GSHARE)
+  {
+    for (int g = 0; g < COUNT(gshareBits); g++)
+    {
+      snprintf(config, sizeof(config), "gshare:%d", gshareBits[g]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == TOURNAMENT)
+  {
+    int num_l = COUNT(tournamentLocal), num_c = COUNT(tournamentChooser);
+    for (int i = 0; i < COUNT(tournamentGlobal) * num_l * num_c; i++)
+    {
+      snprintf(config, sizeof(config), "tournament:%d:%d:%d", tournamentGlobal[i / (num_l * num_c)],
+               tournamentLocal[(i / num_c) % num_l], tournamentChooser[i % num_c]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == CUSTOM)
+  {
+    int num_l = COUNT(customLocal), num_c = COUNT(customChooser);
+    int num_h = COUNT(customHistory), num_n = COUNT(customPerceptrons);
+    for (int i = 0; i < COUNT(customGlobal) * num_l * num_c * num_h * num_n; i++)
+    {
+      int rest = i;
+      int n = rest % num_n;
+      rest /= num_n;
+      int h = rest % num_h;
+      rest /= num_h;
+      int c = rest % num_c;
+      rest /= num_c;
+      int l = rest % num_l;
+      int g = rest / num_l;
+      snprintf(config, sizeof(config), "custom:%d:%d:%d:%d:%d", customGlobal[g], customLocal[l],
+               customChooser[c], customHistory[h], customPerceptrons[n]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == TAGE)
+  {
+    int num_n = COUNT(tageTableCounts), num_t = COUNT(tageTableSizes);
+    int num_g = COUNT(tageTags), num_h = COUNT(tageHistories);
+    for (int i = 0; i < COUNT(tageBase) * num_n * num_t * num_g * num_h; i++)
+    {
+      int rest = i;
+      int h = rest % num_h;
+      rest /= num_h;
+      int g = rest % num_g;
+      rest /= num_g;
+      int t = rest % num_t;
+      rest /= num_t;
+      int n = rest % num_n;
+      int b = rest / num_n;
+      snprintf(config, sizeof(config), "tage:%d:%d:%d:%d:%d", tageBase[b], tageTableCounts[n],
+               tageTableSizes[t], tageTags[g], tageHistories[h]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == PERCEPTRON)
+  {
+    int num_t = COUNT(perceptronTableSizes), num_h = COUNT(perceptronHistories);
+    for (int i = 0; i < COUNT(perceptronTableCounts) * num_t * num_h; i++)
+    {
+      snprintf(config, sizeof(config), "perceptron:%d:%d:%d", perceptronTableCounts[i / (num_t * num_h)],
+               perceptronTableSizes[(i / num_h) % num_t], perceptronHistories[i % num_h]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == PIECEWISE)
+  {
+    int num_p = COUNT(piecewisePaths), num_h = COUNT(piecewiseHistories);
+    for (int i = 0; i < COUNT(piecewiseAddrs) * num_p * num_h; i++)
+    {
+      snprintf(config, sizeof(config), "piecewise:%d:%d:%d", piecewiseAddrs[i / (num_p * num_h)],
+               piecewisePaths[(i / num_h) % num_p], piecewiseHistories[i % num_h]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == YAGS)
+  {
+    int num_s = COUNT(yagsSets), num_t = COUNT(yagsTags), num_w = COUNT(yagsWayCounts);
+    for (int i = 0; i < COUNT(yagsChoice) * num_s * num_t * num_w; i++)
+    {
+      int rest = i;
+      int w = rest % num_w;
+      rest /= num_w;
+      int t = rest % num_t;
+      rest /= num_t;
+      int s = rest % num_s;
+      int c = rest / num_s;
+      snprintf(config, sizeof(config), "yags:%d:%d:%d:%d", yagsChoice[c], yagsSets[s], yagsTags[t], yagsWayCounts[w]);
+      add_point(config, budget);
+    }
+  }
+  if (type < 0 || type == BIMODE)
+  {
+    for (int i = 0; i < COUNT(bimodeChoice) * COUNT(bimodeDirection); i++)
+    {
+      snprintf(config, sizeof(config), "bimode:%d:%d", bimodeChoice[i / COUNT(bimodeDirection)],
+               bimodeDirection[i % COUNT(bimodeDirection)]);
+      add_point(config, budget);
+    }
+  }
+}
+
+static int compare_points(const void *a, const void *b)
+{
+  const dse_point *x = (const dse_point *)a;
+  const dse_point *y = (const dse_point *)b;
+  if (x->bits != y->bits)
+  {
+    return (x->bits > y->bits) - (x->bits < y->bits);
+  }
+  return (x->mean > y->mean) - (x->mean < y->mean);
+}
+
+// Simulate every point on every trace and fill in its rates
+//
+// Returns True if every trace was simulated
+//
+static int evaluate_points(const char **traces, int num_traces, int threads, uint32_t *max_branches)
+{
+  char **configs = (char **)malloc(num_points * sizeof(char *));
+  for (int i = 0; i < num_points; i++)
+  {
+    configs[i] = points[i].config;
+  }
+  sim_result *results = (sim_result *)calloc(num_traces * num_points, sizeof(sim_result));
+  simulate_all(traces, num_traces, configs, num_points, DSE_GROUP, threads, results);
+
+  int ok = 1;
+  for (int i = 0; i < num_points; i++)
+  {
+    if (mean_rates(results, num_traces, num_points, i, &points[i].mean, &points[i].geomean) < num_traces)
+    {
+      ok = 0;
+    }
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "Some traces failed to simulate\n");
+  }
+
+  *max_branches = 0;
+  for (int i = 0; i < num_traces * num_points; i++)
+  {
+    if (results[i].num_branches > *max_branches)
+    {
+      *max_branches = results[i].num_branches;
+    }
+  }
+  free(configs);
+  free(results);
+  return ok;
+}
+
+static int compare_rates(const void *a, const void *b)
+{
+  const dse_point *x = (const dse_point *)a;
+  const dse_point *y = (const dse_point *)b;
+  return (x->mean > y->mean) - (x->mean < y->mean);
+}
+
+int run_dse(const char **traces, int num_traces, int type, uint64_t budget, int threads)
+{
+  num_points = 0;
+  enumerate(type, budget);
+  if (num_points == 0)
+  {
+    fprintf(stderr, "No configuration fits in %llu bits\n", (unsigned long long)budget);
+    return 0;
+  }
+
+  uint32_t max_branches;
+  int ok = evaluate_points(traces, num_traces, threads, &max_branches);
+
+  // Front: sorted by storage, each point beats every smaller one
+  qsort(points, num_points, sizeof(dse_point), compare_points);
+  printf("Evaluated %d configurations within %llu bits on %d traces\n", num_points,
+         (unsigned long long)budget, num_traces);
+  printf("%12s %9s %9s  %s\n", "Storage", "Mean", "Geomean", "Configuration");
+  double best = -1;
+  for (int i = 0; i < num_points; i++)
+  {
+    if (best < 0 || points[i].mean < best)
+    {
+      best = points[i].mean;
+      printf("%12llu %9.3f %9.3f  %s\n", (unsigned long long)points[i].bits, points[i].mean,
+             points[i].geomean, points[i].config);
+    }
+  }
+
+  for (int i = 0; i < num_points; i++)
+  {
+    free(points[i].config);
+  }
+  return ok;
+}
+
+int run_tune(const char **traces, int num_traces, char **configs, int num_configs,
+             int type, uint64_t budget, uint64_t prefix, int threads)
+{
+  num_points = 0;
+  if (configs != NULL)
+  {
+    for (int i = 0; i < num_configs; i++)
+    {
+      add_point(configs[i], UINT64_MAX);
+    }
+  }
+  else
+  {
+    enumerate(type, budget);
+  }
+  if (num_points == 0)
+  {
+    fprintf(stderr, "No configuration to tune\n");
+    return 0;
+  }
+
+  // Each rung runs the survivors on a longer prefix; the last one runs
+  // them on the full traces
+  uint64_t window = count_branches;
+  int ok = 1;
+  int full = 0;
+  printf("%12s %14s %9s  %s\n", "Prefix", "Configurations", "Best", "Configuration");
+  while (!full)
+  {
+    full = (prefix == 0 || (window > 0 && prefix >= window));
+    count_branches = full ? window : prefix;
+
+    uint32_t max_branches;
+    ok = evaluate_points(traces, num_traces, threads, &max_branches) && ok;
+    qsort(points, num_points, sizeof(dse_point), compare_rates);
+
+    // A prefix longer than every trace covered them all
+    full = full || (uint64_t)max_branches < prefix;
+    if (full)
+    {
+      printf("%12s %14d %9.3f  %s\n", "full", num_points, points[0].mean, points[0].config);
+      break;
+    }
+    printf("%12llu %14d %9.3f  %s\n", (unsigned long long)prefix, num_points, points[0].mean, points[0].config);
+
+    int keep = num_points / TUNE_ETA;
+    for (int i = (keep > 0) ? keep : 1; i < num_points; i++)
+    {
+      free(points[i].config);
+    }
+    num_points = (keep > 0) ? keep : 1;
+    prefix = (num_points > 1) ? prefix * TUNE_ETA : 0;
+  }
+  count_branches = window;
+
+  printf("\n%12s %9s %9s  %s\n", "Storage", "Mean", "Geomean", "Configuration");
+  for (int i = 0; i < num_points; i++)
+  {
+    load_predictor(&default_config);
+    parse_config(points[i].config);
+    printf("%12llu %9.3f %9.3f  %s\n", (unsigned long long)predictor_storage_bits(), points[i].mean,
+           points[i].geomean, points[i].config);
+    free(points[i].config);
+  }
+  return ok;
+}
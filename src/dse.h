@@ -0,0 +1,44 @@
+//========================================================//
+//  dse.h                                                 //
+//  Header file for the design-space exploration and      //
+//  tuning drivers                                        //
+//                                                        //
+//  Evaluates the configurations that fit a storage       //
+//  budget and reports the best rate for each size, or    //
+//  narrows them down by successive halving               //
+//========================================================//
+
+#ifndef DSE_H
+#define DSE_H
+
+#include <stdint.h>
+
+// Hardware budget of the custom predictor: 256 Kbit + 1024 bits
+#define DSE_BUDGET (256 * 1024 + 1024)
+
+// Simulate every configuration of 'type' (-1 for all types but
+// static) in the built-in design space that fits in 'budget' bits on
+// all traces, on 'threads' threads, and print the Pareto front of
+// storage against mean misprediction rate
+//
+// Returns True if Successful
+//
+int run_dse(const char **traces, int num_traces, int type, uint64_t budget, int threads);
+
+// Successive halving: the tuner starts on the first TUNE_PREFIX
+// conditional branches of each trace, keeps the best 1/TUNE_ETA of
+// the configurations and multiplies the prefix by TUNE_ETA, until the
+// survivors have run on the full traces
+#define TUNE_PREFIX 500000
+#define TUNE_ETA 2
+
+// Tune over configs[0, num_configs), or when 'configs' is NULL over
+// the design space of run_dse, starting from 'prefix' branches, and
+// print the final ranking
+//
+// Returns True if Successful
+//
+int run_tune(const char **traces, int num_traces, char **configs, int num_configs,
+             int type, uint64_t budget, uint64_t prefix, int threads);
+
+#endif
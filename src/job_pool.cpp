@@ -0,0 +1,141 @@
+//========================================================//
+//  job_pool.cpp                                          //
+//  Source file for the work-stealing job pool            //
+//                                                        //
+//  Each thread owns a deque of jobs. Owners take jobs    //
+//  from the front, thieves from the back, so a thief     //
+//  takes the jobs its victim would have run last.        //
+//========================================================//
+#include <stdlib.h>
+#include <pthread.h>
+#include "job_pool.h"
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  int *jobs;
+  int head; // next job of the owner
+  int tail; // one past the job a thief takes
+} job_deque;
+
+typedef struct
+{
+  job_deque *deques;
+  int threads;
+  job_func run;
+  void *arg;
+} job_pool;
+
+typedef struct
+{
+  job_pool *pool;
+  int id;
+  pthread_t thread;
+} job_worker;
+
+//------------------------------------//
+//          Deque Functions           //
+//------------------------------------//
+
+// Returns True if a job was taken
+//
+static int take_job(job_deque *deque, int steal, int *job)
+{
+  int ok = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->head < deque->tail)
+  {
+    *job = steal ? deque->jobs[--deque->tail] : deque->jobs[deque->head++];
+    ok = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return ok;
+}
+
+static void *worker_main(void *arg)
+{
+  job_worker *worker = (job_worker *)arg;
+  job_pool *pool = worker->pool;
+  int job;
+
+  while (1)
+  {
+    if (take_job(&pool->deques[worker->id], 0, &job))
+    {
+      pool->run(job, pool->arg);
+      continue;
+    }
+
+    // No jobs are ever added, so once every deque is empty the
+    // remaining jobs are all running
+    int stolen = 0;
+    for (int i = 1; i < pool->threads && !stolen; i++)
+    {
+      stolen = take_job(&pool->deques[(worker->id + i) % pool->threads], 1, &job);
+    }
+    if (!stolen)
+    {
+      return NULL;
+    }
+    pool->run(job, pool->arg);
+  }
+}
+
+//------------------------------------//
+//           Pool Functions           //
+//------------------------------------//
+
+void job_pool_run(int threads, const int *order, int num_jobs, job_func run, void *arg)
+{
+  if (threads > num_jobs)
+  {
+    threads = num_jobs;
+  }
+  if (threads <= 1)
+  {
+    for (int i = 0; i < num_jobs; i++)
+    {
+      run(order[i], arg);
+    }
+    return;
+  }
+
+  job_pool pool;
+  pool.deques = (job_deque *)malloc(threads * sizeof(job_deque));
+  pool.threads = threads;
+  pool.run = run;
+  pool.arg = arg;
+  for (int t = 0; t < threads; t++)
+  {
+    job_deque *deque = &pool.deques[t];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->jobs = (int *)malloc((num_jobs / threads + 1) * sizeof(int));
+    deque->head = 0;
+    deque->tail = 0;
+  }
+  for (int i = 0; i < num_jobs; i++)
+  {
+    job_deque *deque = &pool.deques[i % threads];
+    deque->jobs[deque->tail++] = order[i];
+  }
+
+  job_worker *workers = (job_worker *)malloc(threads * sizeof(job_worker));
+  for (int t = 0; t < threads; t++)
+  {
+    workers[t].pool = &pool;
+    workers[t].id = t;
+    pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+  }
+  for (int t = 0; t < threads; t++)
+  {
+    pthread_join(workers[t].thread, NULL);
+  }
+
+  for (int t = 0; t < threads; t++)
+  {
+    pthread_mutex_destroy(&pool.deques[t].lock);
+    free(pool.deques[t].jobs);
+  }
+  free(pool.deques);
+  free(workers);
+}
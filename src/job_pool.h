@@ -0,0 +1,22 @@
+//========================================================//
+//  job_pool.h                                            //
+//  Header file for the work-stealing job pool            //
+//                                                        //
+//  Runs a fixed set of independent jobs of very          //
+//  different lengths on a pool of threads                //
+//========================================================//
+
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+typedef void (*job_func)(int job, void *arg);
+
+// Run 'run(job, arg)' for every job in order[0, num_jobs) on
+// 'threads' threads and wait for all of them. Jobs are dealt out
+// round robin; each thread runs its own jobs in 'order' and, when
+// it has none left, steals from the back of another thread's jobs.
+// Listing the longest jobs first keeps the threads evenly busy.
+//
+void job_pool_run(int threads, const int *order, int num_jobs, job_func run, void *arg);
+
+#endif
@@ -7,26 +7,137 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "predictor.h"
+#include "trace.h"
+#include "trace_cache.h"
+#include "simulate.h"
+#include "dse.h"
+#include "perf_counters.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+// Traces to simulate; none reads stdin
+const char **trace_paths = NULL;
+int num_traces = 0;
+
+// Threads running (trace, configuration) jobs when simulating several
+// traces; 0 uses one per core
+int num_jobs = 0;
+int jobs_requested = 0;
+
+// Configuration given by the --<type> option
+const char *type_config = "static";
+int type_given = 0;
+
+// Storage budget of a design-space exploration (--dse); 0 when not
+// exploring
+uint64_t dse_budget = 0;
+
+// First prefix of a successive-halving tuning run (--tune); 0 when
+// not tuning
+uint64_t tune_prefix = 0;
+
+// Print hardware event counts per branch of a single-trace run
+// (--perf)
+int count_perf = 0;
+
+// Predictor configurations simulated side by side on one pass over
+// the trace (--sweep); empty for a normal run
+char **sweep_configs = NULL;
+int num_sweep_configs = 0;
 
 // Print out the Usage information to stderr
 //
 void usage()
 {
-  fprintf(stderr, "Usage: predictor <options> [<trace>]\n");
+  fprintf(stderr, "Usage: predictor <options> [<trace>...]\n");
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr, " <trace> may be a text, bzip2, binary or predictor-coded (see\n");
+  fprintf(stderr, "         trace_convert) trace\n");
+  fprintf(stderr, " Set $BP_TRACE_CACHE to a directory to keep decoded copies of traces\n"
+                  " there (at most $BP_TRACE_CACHE_SIZE MB, default %d)\n", TRACE_CACHE_SIZE);
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
   fprintf(stderr, " --verbose    Print predictions on stdout\n");
+  fprintf(stderr, " --threads=<n> Threads decoding a bzip2 trace (default: one per core)\n");
+  fprintf(stderr, " --parser=<scalar|sse2|avx2> Text parser (default: fastest supported)\n");
+  fprintf(stderr, " --skip=<n>   Start at the n-th conditional branch, seeking with\n"
+                  "              the trace index if there is one (see trace_convert)\n");
+  fprintf(stderr, " --count=<n>  Simulate only n conditional branches\n");
+  fprintf(stderr, " --load-state=<file> Start from the predictor saved in <file>\n");
+  fprintf(stderr, " --save-state=<file> Save the predictor to <file> after the run\n");
+  fprintf(stderr, " --layout=<split|grouped> Table layout of the tournament and custom\n"
+                  "              predictors: separate tables (default), or the gshare and\n"
+                  "              selector entries of an index on one cache line\n");
+  fprintf(stderr, " --lookahead=<n> Prefetch the table entries of the conditional branch\n"
+                  "              n ahead when the tables exceed L2 (default %d, 0 for off)\n", LOOKAHEAD_DISTANCE);
+  fprintf(stderr, " --sharded[=<n>] Simulate a single trace on n threads (default one per\n"
+                  "              core), each table split into shards replayed in parallel;\n"
+                  "              predictions are the same\n");
+  fprintf(stderr, " --simd=<scalar|avx2|avx512> Kernels of the perceptron and\n"
+                  "              piecewise-linear predictors (default: fastest supported)\n");
+  fprintf(stderr, " --perf       Print cache misses and other hardware events per branch\n");
+  fprintf(stderr, " --aliasing   Count the branches of a gshare or bimode run whose counter\n"
+                  "              was last used by another branch, and those that mispredicted\n");
+  fprintf(stderr, " --sweep=<config>[,<config>...]\n"
+                  "              Simulate several configurations on one pass over the\n"
+                  "              trace and print a row of results per configuration\n");
+  fprintf(stderr, " --sweep-file=<file> Same, with one configuration per line of <file>\n");
+  fprintf(stderr, " --lanes=<off|scalar|avx2> Run the gshare configurations of a sweep\n"
+                  "              side by side on one pass (default: fastest supported)\n");
+  fprintf(stderr, " --jobs=<n>   Simulate several traces (and sweep configurations) on\n"
+                  "              n threads, default one per core, and print the mean\n"
+                  "              and geometric mean misprediction rates\n");
+  fprintf(stderr, " --dse[=<bits>] Simulate the built-in design space of the chosen\n"
+                  "              type (default: all) on the traces, keeping to <bits> of\n"
+                  "              storage (default %d), and print the Pareto front of\n"
+                  "              storage against mean misprediction rate\n", DSE_BUDGET);
+  fprintf(stderr, " --tune[=<n>] Successive halving over the --sweep configurations, or\n"
+                  "              the --dse design space: run them on the first n (default\n"
+                  "              %d) branches of the traces, keep the best half, double\n"
+                  "              n and repeat until the survivors ran on the full traces\n", TUNE_PREFIX);
   fprintf(stderr, " --<type>     Branch prediction scheme:\n");
   fprintf(stderr, "    static\n"
-                  "    gshare\n"
-                  "    tournament\n"
-                  "    custom\n");
+                  "    gshare[:<ghistoryBits>]\n"
+                  "    tournament[:<ghistoryBits>:<lhistoryBitsTournament>:<chooserBits>]\n"
+                  "    custom[:<ghistoryBits>:<lhistoryBitsTournament>:<chooserBits>[:<historyLength>:<numPerceptrons>]]\n"
+                  "    tage[:<baseBits>:<numTables>:<tableBits>:<tagBits>[:<maxHistory>]]\n"
+                  "    perceptron[:<numTables>:<tableBits>:<historyLength>]\n"
+                  "    piecewise[:<addrBits>:<pathBits>:<historyLength>]\n"
+                  "    yags[:<choiceBits>:<setBits>:<tagBits>:<ways>]\n"
+                  "    bimode[:<choiceBits>:<directionBits>]\n");
+  fprintf(stderr, " A <config> is a <type> without the leading dashes\n");
+}
+
+void add_sweep_config(const char *config, size_t len)
+{
+  sweep_configs = (char **)realloc(sweep_configs, (num_sweep_configs + 1) * sizeof(char *));
+  sweep_configs[num_sweep_configs++] = strndup(config, len);
+}
+
+// Add the configurations of a sweep file: one per line, ignoring
+// blank lines and '#' comments
+//
+// Returns True if Successful
+//
+int read_sweep_file(const char *path)
+{
+  FILE *stream = fopen(path, "r");
+  if (stream == NULL)
+  {
+    return 0;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), stream) != NULL)
+  {
+    char *config = line + strspn(line, " \t");
+    size_t len = strcspn(config, "# \t\r\n");
+    if (len > 0)
+    {
+      add_sweep_config(config, len);
+    }
+  }
+  fclose(stream);
+  return 1;
 }
 
 // Process an option and update the predictor
@@ -36,26 +147,140 @@ void usage()
 //
 int handle_option(char *arg)
 {
-  if (!strcmp(arg, "--static"))
+  if (parse_config(arg + 2))
+  {
+    type_config = arg + 2;
+    type_given = 1;
+  }
+  else if (!strcmp(arg, "--dse"))
+  {
+    dse_budget = DSE_BUDGET;
+  }
+  else if (!strncmp(arg, "--dse=", 6) && strtoull(arg + 6, NULL, 0) > 0)
+  {
+    dse_budget = strtoull(arg + 6, NULL, 0);
+  }
+  else if (!strcmp(arg, "--tune"))
+  {
+    tune_prefix = TUNE_PREFIX;
+  }
+  else if (!strncmp(arg, "--tune=", 7) && strtoull(arg + 7, NULL, 0) > 0)
   {
-    bpType = STATIC;
+    tune_prefix = strtoull(arg + 7, NULL, 0);
   }
-  else if (!strncmp(arg, "--gshare", 8))
+  else if (!strncmp(arg, "--sweep=", 8))
   {
-    bpType = GSHARE;
+    for (const char *config = arg + 8; *config != '\0';)
+    {
+      size_t len = strcspn(config, ",");
+      if (len > 0)
+      {
+        add_sweep_config(config, len);
+      }
+      config += len + (config[len] == ',');
+    }
   }
-  else if (!strncmp(arg, "--tournament", 12))
+  else if (!strncmp(arg, "--sweep-file=", 13))
   {
-    bpType = TOURNAMENT;
+    if (!read_sweep_file(arg + 13))
+    {
+      fprintf(stderr, "Unable to read %s: %s\n", arg + 13, strerror(errno));
+      exit(1);
+    }
   }
-  else if (!strncmp(arg, "--custom", 8))
+  else if (!strncmp(arg, "--jobs=", 7))
   {
-    bpType = CUSTOM;
+    num_jobs = atoi(arg + 7);
+    jobs_requested = 1;
   }
   else if (!strcmp(arg, "--verbose"))
   {
     verbose = 1;
   }
+  else if (!strncmp(arg, "--threads=", 10))
+  {
+    traceThreads = atoi(arg + 10);
+  }
+  else if (!strncmp(arg, "--skip=", 7))
+  {
+    skip_branches = strtoull(arg + 7, NULL, 0);
+  }
+  else if (!strncmp(arg, "--count=", 8))
+  {
+    count_branches = strtoull(arg + 8, NULL, 0);
+  }
+  else if (!strncmp(arg, "--load-state=", 13))
+  {
+    load_state_path = arg + 13;
+  }
+  else if (!strncmp(arg, "--save-state=", 13))
+  {
+    save_state_path = arg + 13;
+  }
+  else if (!strcmp(arg, "--layout=split"))
+  {
+    groupedTables = 0;
+  }
+  else if (!strcmp(arg, "--layout=grouped"))
+  {
+    groupedTables = 1;
+  }
+  else if (!strncmp(arg, "--lookahead=", 12))
+  {
+    lookaheadDistance = atoi(arg + 12);
+  }
+  else if (!strcmp(arg, "--sharded"))
+  {
+    shard_threads = 0;
+  }
+  else if (!strncmp(arg, "--sharded=", 10))
+  {
+    shard_threads = atoi(arg + 10);
+  }
+  else if (!strcmp(arg, "--perf"))
+  {
+    count_perf = 1;
+  }
+  else if (!strcmp(arg, "--aliasing"))
+  {
+    countAliasing = 1;
+  }
+  else if (!strcmp(arg, "--lanes=off"))
+  {
+    gshareLanes = LANES_OFF;
+  }
+  else if (!strcmp(arg, "--lanes=scalar"))
+  {
+    gshareLanes = LANES_SCALAR;
+  }
+  else if (!strcmp(arg, "--lanes=avx2"))
+  {
+    gshareLanes = LANES_AVX2;
+  }
+  else if (!strcmp(arg, "--simd=scalar"))
+  {
+    simdKernels = SIMD_SCALAR;
+  }
+  else if (!strcmp(arg, "--simd=avx2"))
+  {
+    simdKernels = SIMD_AVX2;
+  }
+  else if (!strcmp(arg, "--simd=avx512"))
+  {
+    simdKernels = SIMD_AVX512;
+  }
+  else if (!strcmp(arg, "--parser=scalar"))
+  {
+    traceParser = PARSER_SCALAR;
+  }
+  else if (!strcmp(arg, "--parser=sse2"))
+  {
+    traceParser = PARSER_SSE2;
+  }
+  else if (!strcmp(arg, "--parser=avx2"))
+  {
+    traceParser = PARSER_AVX2;
+  }
   else
   {
     return 0;
@@ -64,29 +289,56 @@ int handle_option(char *arg)
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Simulate every configuration on every trace on the job pool and
+// print the rates per trace and their means per configuration
 //
-// Returns True if Successful
+// Returns True if every job was Successful
 //
-int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
+int run_jobs(char **configs, int num_configs)
 {
-  if (getline(&buf, &len, stream) == -1)
+  sim_result *results = (sim_result *)calloc(num_traces * num_configs, sizeof(sim_result));
+  simulate_all(trace_paths, num_traces, configs, num_configs, 1, num_jobs, results);
+
+  int ok = 1;
+  printf("%-32s %-24s %10s %10s %7s\n", "Trace", "Configuration", "Branches", "Incorrect", "Rate");
+  for (int t = 0; t < num_traces; t++)
   {
-    return 0;
+    for (int c = 0; c < num_configs; c++)
+    {
+      sim_result *r = &results[t * num_configs + c];
+      if (!r->ok)
+      {
+        printf("%-32s %-24s %10s\n", trace_paths[t], configs[c], "failed");
+        ok = 0;
+        continue;
+      }
+      float mispredict_rate = 1000 * ((float)r->mispredictions / (float)r->num_branches);
+      printf("%-32s %-24s %10d %10d %7.3f\n", trace_paths[t], configs[c],
+             r->num_branches, r->mispredictions, mispredict_rate);
+    }
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
+  // Means over the traces that ran
+  for (int c = 0; c < num_configs; c++)
+  {
+    double mean, geomean;
+    if (mean_rates(results, num_traces, num_configs, c, &mean, &geomean) > 0)
+    {
+      printf("%-32s %-24s %29.3f\n", "Mean", configs[c], mean);
+      printf("%-32s %-24s %29.3f\n", "Geomean", configs[c], geomean);
+    }
+  }
 
-  return 1;
+  free(results);
+  return ok;
 }
 
 int main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
-  bpType = STATIC;
+  predictorType = STATIC;
   verbose = 0;
+  save_predictor(&default_config);
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i)
@@ -108,53 +360,180 @@ int main(int argc, char *argv[])
     else
     {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      trace_paths = (const char **)realloc(trace_paths, (num_traces + 1) * sizeof(char *));
+      trace_paths[num_traces++] = argv[i];
+    }
+  }
+  for (int i = 0; i < num_sweep_configs; i++)
+  {
+    load_predictor(&default_config);
+    if (!parse_config(sweep_configs[i]))
+    {
+      fprintf(stderr, "Invalid sweep configuration %s\n", sweep_configs[i]);
+      exit(1);
+    }
+  }
+
+  if (load_state_path != NULL || save_state_path != NULL)
+  {
+    if (num_sweep_configs > 0 || num_traces > 1 || jobs_requested || dse_budget > 0 || tune_prefix > 0)
+    {
+      fprintf(stderr, "--load-state and --save-state need a single trace and configuration\n");
+      exit(1);
+    }
+    if (load_state_path != NULL && type_given)
+    {
+      fprintf(stderr, "--load-state takes the predictor type and sizes from the state file\n");
+      exit(1);
+    }
+  }
+
+  if (traceParser >= 0 && !trace_parser_supported(traceParser))
+  {
+    fprintf(stderr, "--parser: this CPU does not support that parser\n");
+    exit(1);
+  }
+  if (simdKernels >= 0 && !simd_kernels_supported(simdKernels))
+  {
+    fprintf(stderr, "--simd: this CPU does not support those kernels\n");
+    exit(1);
+  }
+
+  if (shard_threads >= 0 &&
+      (num_sweep_configs > 0 || num_traces > 1 || jobs_requested || dse_budget > 0 || tune_prefix > 0))
+  {
+    fprintf(stderr, "--sharded needs a single trace and configuration\n");
+    exit(1);
+  }
+
+  if (count_perf && (num_traces > 1 || jobs_requested || dse_budget > 0 || tune_prefix > 0))
+  {
+    fprintf(stderr, "--perf needs a single trace\n");
+    exit(1);
+  }
+
+  if (countAliasing && (num_sweep_configs > 0 || num_traces > 1 || jobs_requested || dse_budget > 0 ||
+                        tune_prefix > 0 || shard_threads >= 0))
+  {
+    fprintf(stderr, "--aliasing needs a single trace and configuration\n");
+    exit(1);
+  }
+
+  if (dse_budget > 0 || tune_prefix > 0)
+  {
+    if (num_traces == 0)
+    {
+      fprintf(stderr, "--dse and --tune need the traces as arguments\n");
+      exit(1);
+    }
+    if (traceThreads == 0)
+    {
+      traceThreads = 1;
+    }
+    int type = (type_given && predictorType != STATIC) ? predictorType : -1;
+    uint64_t budget = (dse_budget > 0) ? dse_budget : DSE_BUDGET;
+    int ok;
+    if (tune_prefix > 0)
+    {
+      ok = run_tune(trace_paths, num_traces, (num_sweep_configs > 0) ? sweep_configs : NULL,
+                    num_sweep_configs, type, budget, tune_prefix, num_jobs);
     }
+    else
+    {
+      ok = run_dse(trace_paths, num_traces, type, budget, num_jobs);
+    }
+    return ok ? 0 : 1;
   }
 
-  // Initialize the predictor
-  init_predictor();
+  if (num_traces > 1 || jobs_requested)
+  {
+    if (num_traces == 0)
+    {
+      fprintf(stderr, "--jobs needs the traces as arguments\n");
+      exit(1);
+    }
+    // Jobs already run in parallel, so each decodes its trace on a
+    // single background thread unless asked otherwise
+    if (traceThreads == 0)
+    {
+      traceThreads = 1;
+    }
+    char *single = (char *)type_config;
+    int ok = (num_sweep_configs > 0) ? run_jobs(sweep_configs, num_sweep_configs) : run_jobs(&single, 1);
+    return ok ? 0 : 1;
+  }
 
+  const char *trace_path = (num_traces > 0) ? trace_paths[0] : NULL;
+  int num_configs = (num_sweep_configs > 0) ? num_sweep_configs : 1;
   uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint32_t target = 0;
-  uint32_t outcome = NOTTAKEN;
-  uint32_t condition = 0;
-  uint32_t call = 0;
-  uint32_t ret = 0;
-  uint32_t direct = 0;
-
-  // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
-  {
-    if (condition == 1)
-    {
-      num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
+  uint32_t *mispredictions = (uint32_t *)calloc(num_configs, sizeof(uint32_t));
+  perf_counters counters;
+  int64_t events[PERF_EVENTS];
+  if (count_perf)
+  {
+    perf_counters_start(&counters);
+  }
+  if (!simulate_trace(trace_path, (num_sweep_configs > 0) ? sweep_configs : NULL, num_configs,
+                      &num_branches, mispredictions))
+  {
+    exit(1);
+  }
+  if (count_perf)
+  {
+    perf_counters_stop(&counters, events);
+  }
+
+  // Print out the mispredict statistics
+  if (num_sweep_configs == 0)
+  {
+    printf("Branches:        %10d\n", num_branches);
+    printf("Incorrect:       %10d\n", mispredictions[0]);
+    float mispredict_rate = 1000 * ((float)mispredictions[0] / (float)num_branches);
+    printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  }
+  else
+  {
+    printf("%-32s %10s %10s %7s\n", "Configuration", "Branches", "Incorrect", "Rate");
+    for (int i = 0; i < num_sweep_configs; i++)
+    {
+      float mispredict_rate = 1000 * ((float)mispredictions[i] / (float)num_branches);
+      printf("%-32s %10d %10d %7.3f\n", sweep_configs[i], num_branches, mispredictions[i], mispredict_rate);
+    }
+  }
+
+  // Aliasing per thousand branches, like the misprediction rate
+  if (countAliasing && !trace_aliasing_counted)
+  {
+    printf("Aliasing:        not counted for %s\n", bpName[predictorType]);
+  }
+  else if (countAliasing)
+  {
+    uint64_t accesses = (trace_aliasing.accesses > 0) ? trace_aliasing.accesses : 1;
+    printf("Aliased:         %10llu\n", (unsigned long long)trace_aliasing.aliased);
+    printf("Destructive:     %10llu\n", (unsigned long long)trace_aliasing.destructive);
+    printf("Aliasing Rate:      %7.3f\n", 1000 * ((float)trace_aliasing.aliased / (float)accesses));
+    printf("Destructive Rate:   %7.3f\n", 1000 * ((float)trace_aliasing.destructive / (float)accesses));
+  }
+
+  // And the hardware events of the run, per conditional branch
+  if (count_perf)
+  {
+    printf("%-20s %14s %12s\n", "Event", "Count", "Per Branch");
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+      if (events[i] < 0)
       {
-        mispredictions++;
+        printf("%-20s %14s\n", perf_event_names[i], "unavailable");
       }
-      if (verbose != 0)
+      else
       {
-        printf("%d\n", prediction);
+        printf("%-20s %14lld %12.4f\n", perf_event_names[i], (long long)events[i],
+               (double)events[i] / (num_branches > 0 ? num_branches : 1));
       }
     }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
   }
 
-  // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
-
-  // Cleanup
-  fclose(stream);
-  free(buf);
+  free(mispredictions);
 
   return 0;
 }
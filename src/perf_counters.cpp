@@ -0,0 +1,81 @@
+//========================================================//
+//  perf_counters.cpp                                     //
+//  Source file for counting hardware events of the       //
+//  calling thread, and the threads it starts, with       //
+//  perf_event_open                                       //
+//========================================================//
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf_counters.h"
+
+const char *perf_event_names[PERF_EVENTS] = {"Task clock (ns)", "Instructions",
+                                             "L1D read misses", "LLC misses"};
+
+static const uint32_t event_types[PERF_EVENTS] = {PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE,
+                                                  PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+
+static const uint64_t event_configs[PERF_EVENTS] = {
+    PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_MISSES};
+
+int perf_counters_start(perf_counters *counters)
+{
+  int started = 0;
+  for (int i = 0; i < PERF_EVENTS; i++)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event_types[i];
+    attr.config = event_configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counters->fds[i] >= 0)
+    {
+      started++;
+    }
+  }
+
+  // Enable the events last, so opening them is not counted
+  for (int i = 0; i < PERF_EVENTS; i++)
+  {
+    if (counters->fds[i] >= 0)
+    {
+      ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  return started;
+}
+
+void perf_counters_stop(perf_counters *counters, int64_t *values)
+{
+  for (int i = 0; i < PERF_EVENTS; i++)
+  {
+    if (counters->fds[i] >= 0)
+    {
+      ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (int i = 0; i < PERF_EVENTS; i++)
+  {
+    values[i] = -1;
+    if (counters->fds[i] >= 0)
+    {
+      uint64_t count;
+      if (read(counters->fds[i], &count, sizeof(count)) == sizeof(count))
+      {
+        values[i] = count;
+      }
+      close(counters->fds[i]);
+      counters->fds[i] = -1;
+    }
+  }
+}
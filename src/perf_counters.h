@@ -0,0 +1,36 @@
+//========================================================//
+//  perf_counters.h                                       //
+//  Header file for counting hardware events of the       //
+//  calling thread, and the threads it starts, with       //
+//  perf_event_open                                       //
+//========================================================//
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+// Task clock (ns), instructions, L1 data cache read misses and
+// last-level cache misses
+#define PERF_EVENTS 4
+
+extern const char *perf_event_names[PERF_EVENTS];
+
+typedef struct
+{
+  int fds[PERF_EVENTS]; // -1 for events this machine cannot count
+} perf_counters;
+
+// Start counting the events of the calling thread, and of the
+// threads it starts from now on, in user space
+//
+// Returns the number of events being counted
+//
+int perf_counters_start(perf_counters *counters);
+
+// Stop counting and close the counters. values[i] receives the count
+// of event i, or -1 if it was not counted.
+//
+void perf_counters_stop(perf_counters *counters, int64_t *values);
+
+#endif
@@ -8,6 +8,11 @@
 #include <stdio.h>
 #include <math.h>
 #include "predictor.h"
+#include "predictors.h"
+#include "job_pool.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include <string.h>
 #include <cstring>
 #include <stdint.h>
@@ -24,472 +29,1632 @@ const char *email = "a1deshmukh@ucsd.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[9] = {"Static", "Gshare",     "Tournament",       "Custom", "TAGE",
+                         "Perceptron", "Piecewise-Linear", "YAGS", "Bi-Mode"};
 
 // define number of bits required for indexing the BHT here.
-int ghistoryBitsTournament = 16; // Number of bits used for Global History
+// The configuration and tables are per thread, so that every thread
+// of a --jobs run has a predictor of its own.
+thread_local int ghistoryBitsTournament = 16; // Number of bits used for Global History
 
-int ghistoryBitsGshare = 17;
+thread_local int ghistoryBitsGshare = 17;
 
 int lhistoryBits = 16;
+thread_local int lhistoryBitsTournament = 16;
 int chooserBits = 10;
 
-int chooserBitsTournament = 10;
-int bpType;            // Branch Prediction Type
+thread_local int chooserBitsTournament = 10;
+int bpType;                       // Branch Prediction Type
+thread_local int predictorType;   // of this thread's predictor
+thread_local int threadConfigured; // predictorType is set, not bpType
 int verbose;
 
-int ghistoryBitsCustom = 15;
-int lhistoryBitsCustom = 15;
-int chooserBitsCustom = 16;
+thread_local int ghistoryBitsCustom = 15;
+thread_local int lhistoryBitsCustom = 15;
+thread_local int chooserBitsCustom = 16;
+
+// Perceptron history length and count, set with custom:g:l:c:<h>:<n>
+thread_local int historyLength = 5;
+thread_local int numPerceptrons = 5;
+
+// TAGE sizes, set with tage:<base>:<tables>:<tableBits>:<tagBits>[:<maxHistory>].
+// The defaults take 245998 bits, inside a 256 Kbit budget.
+thread_local int tageBaseBits = 13;
+thread_local int tageTables = 7;
+thread_local int tageTableBits = 11;
+thread_local int tageTagBits = 11;
+thread_local int tageMaxHistory = 200;
+
+// Hashed perceptron sizes, set with perceptron:<tables>:<tableBits>:<history>.
+// The defaults take 246075 bits.
+thread_local int perceptronTables = 15;
+thread_local int perceptronTableBits = 11;
+thread_local int perceptronHistory = 300;
+
+// Piecewise-linear sizes, set with piecewise:<addrBits>:<pathBits>:<history>.
+// The defaults take 254518 bits.
+thread_local int piecewiseAddrBits = 5;
+thread_local int piecewisePathBits = 4;
+thread_local int piecewiseHistory = 62;
+
+// YAGS sizes, set with yags:<choiceBits>:<setBits>:<tagBits>:<ways>.
+// The defaults take 53258 bits, a fifth of the budget.
+thread_local int yagsChoiceBits = 11;
+thread_local int yagsSetBits = 10;
+thread_local int yagsTagBits = 8;
+thread_local int yagsWays = 2;
+
+// Bi-mode choice and direction table sizes, set with bimode:<choiceBits>:<directionBits>
+thread_local int choiceBitsBimode = 12;
+thread_local int directionBitsBimode = 15;
+
+int simdKernels = -1;
+int countAliasing = 0;
+
+int groupedTables = 0;
+int lookaheadDistance = LOOKAHEAD_DISTANCE;
 
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
 
-//
-// TODO: Add your own Branch Predictor data structures here
-//
-// gshare
-uint8_t *bht_gshare;
-uint64_t ghistory;
+// The current predictor of this thread: an instance of the class of
+// predictorType (see predictors.h), or NULL for the static predictor
+thread_local void *current;
 
-// tournament
-uint8_t *bht_lht;  
-uint64_t *local_history; 
-
-uint8_t *selector;  
+static TournamentTables *tournament_tables()
+{
+  if (predictorType == TOURNAMENT)
+  {
+    return (TournamentPredictor *)current;
+  }
+  return (CustomPredictor *)current;
+}
 
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
-// Initialize the predictor
-//
+int tage_config_valid()
+{
+  return tageBaseBits >= 1 && tageBaseBits <= 30 && tageTables >= 1 && tageTables <= TAGE_MAX_TABLES &&
+         tageTableBits >= 1 && tageTableBits <= 24 && tageTagBits >= 2 && tageTagBits <= 16 &&
+         tageMaxHistory >= TAGE_MIN_HISTORY && tageMaxHistory <= TAGE_MAX_HISTORY;
+}
 
-// gshare functions
-void init_gshare(int gHistoryBitsX)
+int perceptron_config_valid()
 {
-  int bht_entries = 1 << gHistoryBitsX;
+  return perceptronTables >= 2 && perceptronTables <= PERCEPTRON_MAX_TABLES && perceptronTableBits >= 1 &&
+         perceptronTableBits <= 24 && perceptronHistory >= perceptronTables - 1 &&
+         perceptronHistory <= PERCEPTRON_MAX_HISTORY;
+}
 
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
-  {
-    bht_gshare[i] = WN;
-  }
-  ghistory = 0;
+int piecewise_config_valid()
+{
+  return piecewiseAddrBits >= 1 && piecewiseAddrBits <= 16 && piecewisePathBits >= 1 && piecewisePathBits <= 16 &&
+         piecewiseAddrBits + piecewisePathBits <= 22 && piecewiseHistory >= 1 &&
+         piecewiseHistory <= PIECEWISE_MAX_HISTORY;
 }
 
-uint8_t gshare_predict(uint32_t pc, int gHistoryBitsX)
+int yags_config_valid()
 {
-  // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << gHistoryBitsX;
+  return yagsChoiceBits >= 1 && yagsChoiceBits <= 30 && yagsSetBits >= 0 && yagsSetBits <= 24 && yagsTagBits >= 1 &&
+         yagsTagBits <= 15 && yagsWays >= 1 && yagsWays <= YAGS_MAX_WAYS;
+}
+
+int bimode_config_valid()
+{
+  return choiceBitsBimode >= 1 && choiceBitsBimode <= 30 && directionBitsBimode >= 1 && directionBitsBimode <= 30;
+}
 
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
-  switch (bht_gshare[index])
+static int detect_kernels()
+{
+#ifdef __SSE2__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
   {
-  case WN:
-    return NOTTAKEN;
-  case SN:
-    return NOTTAKEN;
-  case WT:
-    return TAKEN;
-  case ST:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    return NOTTAKEN;
+    return SIMD_AVX512;
   }
+  return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+// The widest kernels of this CPU, detected once
+//
+static int widest_kernels()
+{
+  static const int widest = detect_kernels();
+  return widest;
 }
 
-void train_gshare(uint32_t pc, uint8_t outcome, int ghistoryBitsX)
+int simd_kernels_supported(int kernels)
 {
-  // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << ghistoryBitsX;
+  return kernels >= SIMD_SCALAR && kernels <= widest_kernels();
+}
 
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
+// The kernels asked for, or the widest this CPU supports. Reads
+// simdKernels without writing it, as configurations are set up on
+// several threads.
+//
+static int pick_kernels()
+{
+  int kernels = simdKernels;
+  return simd_kernels_supported(kernels) ? kernels : widest_kernels();
+}
 
-  // Update state of entry in bht based on outcome
-  switch (bht_gshare[index])
+// Initialize the predictor
+//
+void init_predictor()
+{
+  if (!threadConfigured)
+  {
+    predictorType = bpType;
+    lhistoryBitsTournament = lhistoryBits;
+  }
+  switch (predictorType)
+  {
+  case STATIC:
+    current = NULL;
+    break;
+  case GSHARE:
+  {
+    GsharePredictor *p = new GsharePredictor;
+    p->init(ghistoryBitsGshare);
+    current = p;
+    break;
+  }
+  case TOURNAMENT:
+  {
+    TournamentPredictor *p = new TournamentPredictor;
+    p->init(ghistoryBitsTournament, lhistoryBitsTournament, chooserBitsTournament);
+    current = p;
+    break;
+  }
+  case CUSTOM:
   {
-  case WN:
-    bht_gshare[index] = (outcome == TAKEN) ? WT : SN;
+    CustomPredictor *p = new CustomPredictor;
+    p->init(ghistoryBitsCustom, lhistoryBitsCustom, chooserBitsCustom, historyLength, numPerceptrons);
+    current = p;
     break;
-  case SN:
-    bht_gshare[index] = (outcome == TAKEN) ? WN : SN;
+  }
+  case TAGE:
+  {
+    TagePredictor *p = new TagePredictor;
+    p->init(tageBaseBits, tageTables, tageTableBits, tageTagBits, tageMaxHistory);
+    current = p;
+    break;
+  }
+  case PERCEPTRON:
+  {
+    PerceptronPredictor *p = new PerceptronPredictor;
+    p->init(perceptronTables, perceptronTableBits, perceptronHistory, pick_kernels() >= SIMD_AVX2);
+    current = p;
+    break;
+  }
+  case PIECEWISE:
+  {
+    PiecewisePredictor *p = new PiecewisePredictor;
+    p->init(piecewiseAddrBits, piecewisePathBits, piecewiseHistory, pick_kernels());
+    current = p;
     break;
-  case WT:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WN;
+  }
+  case YAGS:
+  {
+    YagsPredictor *p = new YagsPredictor;
+    p->init(yagsChoiceBits, yagsSetBits, yagsTagBits, yagsWays);
+    current = p;
     break;
-  case ST:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WT;
+  }
+  case BIMODE:
+  {
+    BimodePredictor *p = new BimodePredictor;
+    p->init(choiceBitsBimode, directionBitsBimode);
+    current = p;
     break;
+  }
   default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
     break;
   }
-
-  // Update history register
-  ghistory = ((ghistory << 1) | outcome);
 }
 
-void cleanup_gshare()
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+//
+uint32_t make_prediction(uint32_t pc, uint32_t /* target */, uint32_t /* direct */)
 {
-  free(bht_gshare);
-}
 
+  // Make a prediction based on the predictorType
+  switch (predictorType)
+  {
+  case STATIC:
+    return TAKEN;
+  case GSHARE:
+    return ((GsharePredictor *)current)->predict(pc);
+  case TOURNAMENT:
+    return ((TournamentPredictor *)current)->predict(pc);
+  case CUSTOM:
+    return ((CustomPredictor *)current)->predict(pc);
+  case TAGE:
+    return ((TagePredictor *)current)->predict(pc);
+  case PERCEPTRON:
+    return ((PerceptronPredictor *)current)->predict(pc);
+  case PIECEWISE:
+    return ((PiecewisePredictor *)current)->predict(pc);
+  case YAGS:
+    return ((YagsPredictor *)current)->predict(pc);
+  case BIMODE:
+    return ((BimodePredictor *)current)->predict(pc);
+  default:
+    break;
+  }
 
+  // If there is not a compatable predictorType then return NOTTAKEN
+  return NOTTAKEN;
+}
 
+// Train the predictor the last executed branch at PC 'pc' and with
+// outcome 'outcome' (true indicates that the branch was taken, false
+// indicates that the branch was not taken)
+//
 
-void init_tournament()
+void train_predictor(uint32_t pc, uint32_t /* target */, uint32_t outcome, uint32_t condition, uint32_t /* call */,
+                     uint32_t /* ret */, uint32_t /* direct */)
 {
-  //entries
-  int bht_entries = 1 << ghistoryBitsTournament;
-  int lht_entries = 1 << lhistoryBits;
-  int selector_entries = 1 << chooserBitsTournament;
-
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  bht_lht = (uint8_t *)malloc(lht_entries * sizeof(uint8_t)); 
-  local_history = (uint64_t *)malloc(lht_entries * sizeof(uint64_t)); // Local history registers
-
-  selector = (uint8_t *)malloc(selector_entries * sizeof(uint8_t)); // Selector table 
-
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
+  if (condition)
   {
-    bht_gshare[i] = WN;  
+    switch (predictorType)
+    {
+    case STATIC:
+      return;
+    case GSHARE:
+      return ((GsharePredictor *)current)->update(pc, outcome);
+    case TOURNAMENT:
+      return ((TournamentPredictor *)current)->update(pc, outcome);
+    case CUSTOM:
+      return ((CustomPredictor *)current)->update(pc, outcome);
+    case TAGE:
+      return ((TagePredictor *)current)->update(pc, outcome);
+    case PERCEPTRON:
+      return ((PerceptronPredictor *)current)->update(pc, outcome);
+    case PIECEWISE:
+      return ((PiecewisePredictor *)current)->update(pc, outcome);
+    case YAGS:
+      return ((YagsPredictor *)current)->update(pc, outcome);
+    case BIMODE:
+      return ((BimodePredictor *)current)->update(pc, outcome);
+    default:
+      break;
+    }
   }
-  for (i = 0; i< lht_entries; i++)
+}
+
+uint32_t predict_and_update(uint32_t pc, uint32_t target, uint8_t flags, uint32_t outcome)
+{
+  if (!(flags & BR_CONDITION))
   {
-    bht_lht[i] = WN;    
-    local_history[i] = 0; 
+    return NOTTAKEN;
   }
-  for (i = 0; i< selector_entries; i++)
+  switch (predictorType)
   {
-    selector[i] = WN;  
+  case STATIC:
+    return TAKEN;
+  case GSHARE:
+    return ((GsharePredictor *)current)->predict_and_update(pc, outcome);
+  case TOURNAMENT:
+    return ((TournamentPredictor *)current)->predict_and_update(pc, outcome);
+  case CUSTOM:
+    return ((CustomPredictor *)current)->predict_and_update(pc, outcome);
+  case TAGE:
+    return ((TagePredictor *)current)->predict_and_update(pc, outcome);
+  case PERCEPTRON:
+    return ((PerceptronPredictor *)current)->predict_and_update(pc, outcome);
+  case PIECEWISE:
+    return ((PiecewisePredictor *)current)->predict_and_update(pc, outcome);
+  case YAGS:
+    return ((YagsPredictor *)current)->predict_and_update(pc, outcome);
+  case BIMODE:
+    return ((BimodePredictor *)current)->predict_and_update(pc, outcome);
+  default:
+    break;
   }
 
-  ghistory = 0; 
+  uint32_t prediction = make_prediction(pc, target, (flags & BR_DIRECT) ? 1 : 0);
+  train_predictor(pc, target, outcome, 1, (flags & BR_CALL) ? 1 : 0, (flags & BR_RET) ? 1 : 0,
+                  (flags & BR_DIRECT) ? 1 : 0);
+  return prediction;
 }
 
-uint32_t tournament_predict(uint32_t pc)
-{
-  uint32_t gshare_index = (pc ^ ghistory) & ((1 << ghistoryBitsTournament) - 1);
-  uint32_t lht_index = pc & ((1 << lhistoryBits) - 1);
-  uint32_t selector_index = (pc ^ ghistory) & ((1 << chooserBitsTournament) - 1);
-
-  //make two predictions
-  uint8_t gshare_prediction = (bht_gshare[gshare_index] >= WT) ? TAKEN : NOTTAKEN;
-  uint8_t lht_prediction = (bht_lht[lht_index] >= WT) ? TAKEN : NOTTAKEN;
-
-  //selector prediction
-  uint8_t selector_value = selector[selector_index];
+//------------------------------------//
+//         Predictor Contexts         //
+//------------------------------------//
 
-  //choose gshare or lht prediction based on selecgtor
-  return (selector_value >= WT) ? gshare_prediction : lht_prediction;
+void save_predictor(predictor_context *ctx)
+{
+  ctx->bpType = predictorType;
+  ctx->ghistoryBitsGshare = ghistoryBitsGshare;
+  ctx->ghistoryBitsTournament = ghistoryBitsTournament;
+  ctx->lhistoryBits = lhistoryBitsTournament;
+  ctx->chooserBitsTournament = chooserBitsTournament;
+  ctx->ghistoryBitsCustom = ghistoryBitsCustom;
+  ctx->lhistoryBitsCustom = lhistoryBitsCustom;
+  ctx->chooserBitsCustom = chooserBitsCustom;
+  ctx->historyLength = historyLength;
+  ctx->numPerceptrons = numPerceptrons;
+  ctx->tageBaseBits = tageBaseBits;
+  ctx->tageTables = tageTables;
+  ctx->tageTableBits = tageTableBits;
+  ctx->tageTagBits = tageTagBits;
+  ctx->tageMaxHistory = tageMaxHistory;
+  ctx->perceptronTables = perceptronTables;
+  ctx->perceptronTableBits = perceptronTableBits;
+  ctx->perceptronHistory = perceptronHistory;
+  ctx->piecewiseAddrBits = piecewiseAddrBits;
+  ctx->piecewisePathBits = piecewisePathBits;
+  ctx->piecewiseHistory = piecewiseHistory;
+  ctx->yagsChoiceBits = yagsChoiceBits;
+  ctx->yagsSetBits = yagsSetBits;
+  ctx->yagsTagBits = yagsTagBits;
+  ctx->yagsWays = yagsWays;
+  ctx->choiceBitsBimode = choiceBitsBimode;
+  ctx->directionBitsBimode = directionBitsBimode;
+  ctx->instance = current;
 }
 
-void train_tournament(uint32_t pc, uint8_t outcome)
+void load_predictor(const predictor_context *ctx)
 {
-  uint32_t bht_entries = 1 << ghistoryBitsTournament;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
+  threadConfigured = 1;
+  predictorType = ctx->bpType;
+  ghistoryBitsGshare = ctx->ghistoryBitsGshare;
+  ghistoryBitsTournament = ctx->ghistoryBitsTournament;
+  lhistoryBitsTournament = ctx->lhistoryBits;
+  chooserBitsTournament = ctx->chooserBitsTournament;
+  ghistoryBitsCustom = ctx->ghistoryBitsCustom;
+  lhistoryBitsCustom = ctx->lhistoryBitsCustom;
+  chooserBitsCustom = ctx->chooserBitsCustom;
+  historyLength = ctx->historyLength;
+  numPerceptrons = ctx->numPerceptrons;
+  tageBaseBits = ctx->tageBaseBits;
+  tageTables = ctx->tageTables;
+  tageTableBits = ctx->tageTableBits;
+  tageTagBits = ctx->tageTagBits;
+  tageMaxHistory = ctx->tageMaxHistory;
+  perceptronTables = ctx->perceptronTables;
+  perceptronTableBits = ctx->perceptronTableBits;
+  perceptronHistory = ctx->perceptronHistory;
+  piecewiseAddrBits = ctx->piecewiseAddrBits;
+  piecewisePathBits = ctx->piecewisePathBits;
+  piecewiseHistory = ctx->piecewiseHistory;
+  yagsChoiceBits = ctx->yagsChoiceBits;
+  yagsSetBits = ctx->yagsSetBits;
+  yagsTagBits = ctx->yagsTagBits;
+  yagsWays = ctx->yagsWays;
+  choiceBitsBimode = ctx->choiceBitsBimode;
+  directionBitsBimode = ctx->directionBitsBimode;
+  current = ctx->instance;
+}
 
-  uint32_t gshare_index = pc_lower_bits ^ ghistory_lower_bits;
-  uint32_t lht_index = pc_lower_bits;
+void free_predictor()
+{
+  switch (predictorType)
+  {
+  case GSHARE:
+    if (current != NULL)
+    {
+      ((GsharePredictor *)current)->release();
+      delete (GsharePredictor *)current;
+    }
+    break;
+  case TOURNAMENT:
+    if (current != NULL)
+    {
+      ((TournamentPredictor *)current)->release();
+      delete (TournamentPredictor *)current;
+    }
+    break;
+  case CUSTOM:
+    if (current != NULL)
+    {
+      ((CustomPredictor *)current)->release();
+      delete (CustomPredictor *)current;
+    }
+    break;
+  case TAGE:
+    if (current != NULL)
+    {
+      ((TagePredictor *)current)->release();
+      delete (TagePredictor *)current;
+    }
+    break;
+  case PERCEPTRON:
+    if (current != NULL)
+    {
+      ((PerceptronPredictor *)current)->release();
+      delete (PerceptronPredictor *)current;
+    }
+    break;
+  case PIECEWISE:
+    if (current != NULL)
+    {
+      ((PiecewisePredictor *)current)->release();
+      delete (PiecewisePredictor *)current;
+    }
+    break;
+  case YAGS:
+    if (current != NULL)
+    {
+      ((YagsPredictor *)current)->release();
+      delete (YagsPredictor *)current;
+    }
+    break;
+  case BIMODE:
+    if (current != NULL)
+    {
+      ((BimodePredictor *)current)->release();
+      delete (BimodePredictor *)current;
+    }
+    break;
+  default:
+    break;
+  }
+  current = NULL;
+}
 
-  //make two predictions
-  uint8_t gshare_prediction = gshare_predict(pc, ghistoryBitsTournament);
-  uint8_t lht_prediction = (bht_lht[lht_index] == WT || bht_lht[lht_index] == ST) ? TAKEN : NOTTAKEN;
+//------------------------------------//
+//        Predictor Checkpoints       //
+//------------------------------------//
 
-  uint32_t selector_index = (pc ^ ghistory) & ((1 << chooserBitsTournament) - 1);
+static int write_counters(FILE *stream, const Counters *table, const slot_map &map, uint64_t entries)
+{
+  uint8_t packed[4096];
+  for (uint64_t i = 0; i < entries; i += 4 * sizeof(packed))
+  {
+    uint64_t n = 0;
+    for (uint64_t j = i; j < entries && n < sizeof(packed) * 4; j++, n++)
+    {
+      if (n % 4 == 0)
+      {
+        packed[n / 4] = 0;
+      }
+      packed[n / 4] |= table->get(map_slot(map, j)) << (2 * (n % 4));
+    }
+    if (fwrite(packed, 1, (n + 3) / 4, stream) != (n + 3) / 4)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
 
-  // Update selector based on otucome for each selector and actual outcome
-  if (gshare_prediction == outcome && lht_prediction != outcome) //if gshare is correct and local is wrong
+static int read_counters(FILE *stream, Counters *table, const slot_map &map, uint64_t entries)
+{
+  uint8_t packed[4096];
+  for (uint64_t i = 0; i < entries; i += 4 * sizeof(packed))
   {
-    if (selector[selector_index] < ST)
+    uint64_t n = entries - i < 4 * sizeof(packed) ? entries - i : 4 * sizeof(packed);
+    if (fread(packed, 1, (n + 3) / 4, stream) != (n + 3) / 4)
     {
-      selector[selector_index]++; //increment gshare priority
+      return 0;
     }
+    for (uint64_t j = 0; j < n; j++)
+    {
+      table->set(map_slot(map, i + j), (packed[j / 4] >> (2 * (j % 4))) & 3);
+    }
+  }
+  return 1;
+}
+
+// Tables of the current predictor in file order, with their sizes and
+// where their counters are
+//
+typedef struct
+{
+  Counters *counters[3];
+  slot_map maps[3];
+  uint64_t counter_entries[3];
+  int num_counters;
+  uint64_t *local;
+  uint64_t local_entries;
+  int *weights;
+  uint64_t num_weights;
+  uint64_t *ghistory;
+  uint32_t *globalHistory;
+  void *blocks[2]; // saved as they are in memory
+  uint64_t block_bytes[2];
+  int num_blocks;
+} state_tables;
+
+static void list_tables(state_tables *t)
+{
+  memset(t, 0, sizeof(*t));
+  switch (predictorType)
+  {
+  case GSHARE:
+  {
+    GsharePredictor *p = (GsharePredictor *)current;
+    t->counters[0] = &p->bht;
+    t->maps[0] = split_map;
+    t->counter_entries[0] = 1ULL << p->bits;
+    t->num_counters = 1;
+    t->ghistory = &p->history;
+    break;
   }
-  else if (lht_prediction == outcome && gshare_prediction != outcome) // if local is correct and gshare is wrong
+  case TOURNAMENT:
+  case CUSTOM:
   {
-    if (selector[selector_index] > SN)
+    TournamentTables *p = tournament_tables();
+    t->counters[0] = &p->bht_gshare;
+    t->maps[0] = p->gshare_map;
+    t->counter_entries[0] = 1ULL << p->gbits;
+    t->counters[1] = &p->bht_lht;
+    t->maps[1] = split_map;
+    t->counter_entries[1] = 1ULL << p->lbits;
+    t->counters[2] = &p->selector;
+    t->maps[2] = p->selector_map;
+    t->counter_entries[2] = 1ULL << p->cbits;
+    t->num_counters = 3;
+    t->local = p->local_history;
+    t->local_entries = t->counter_entries[1];
+    t->ghistory = &p->ghistory;
+    if (predictorType == CUSTOM)
     {
-      selector[selector_index]--; //decrement gshare priority
+      CustomPredictor *c = (CustomPredictor *)current;
+      t->weights = c->perceptrons;
+      t->num_weights = (uint64_t)c->numPerceptrons * (c->historyLength + 1);
+      t->globalHistory = &c->globalHistory;
     }
+    break;
   }
+  case TAGE:
+  {
+    TagePredictor *p = (TagePredictor *)current;
+    t->counters[0] = &p->base;
+    t->maps[0] = split_map;
+    t->counter_entries[0] = 1ULL << p->base_bits;
+    t->num_counters = 1;
+    t->blocks[0] = p->tables;
+    t->block_bytes[0] = (sizeof(tage_entry) << p->table_bits) * p->num_tables;
+    t->blocks[1] = p->regs;
+    t->block_bytes[1] = sizeof(tage_registers);
+    t->num_blocks = 2;
+    break;
+  }
+  case PERCEPTRON:
+  {
+    PerceptronPredictor *p = (PerceptronPredictor *)current;
+    t->blocks[0] = p->weights;
+    t->block_bytes[0] = (uint64_t)p->num_tables << p->table_bits;
+    t->blocks[1] = p->regs;
+    t->block_bytes[1] = sizeof(perceptron_registers);
+    t->num_blocks = 2;
+    break;
+  }
+  case PIECEWISE:
+  {
+    PiecewisePredictor *p = (PiecewisePredictor *)current;
+    t->blocks[0] = p->bias;
+    t->block_bytes[0] = p->weight_count();
+    t->blocks[1] = p->regs;
+    t->block_bytes[1] = sizeof(piecewise_registers);
+    t->num_blocks = 2;
+    break;
+  }
+  case YAGS:
+  {
+    YagsPredictor *p = (YagsPredictor *)current;
+    t->counters[0] = &p->choice;
+    t->maps[0] = split_map;
+    t->counter_entries[0] = 1ULL << p->choice_bits;
+    t->num_counters = 1;
+    t->ghistory = &p->history;
+    t->blocks[0] = p->caches[NOTTAKEN];
+    t->block_bytes[0] = p->cache_bytes();
+    t->blocks[1] = p->caches[TAKEN];
+    t->block_bytes[1] = p->cache_bytes();
+    t->num_blocks = 2;
+    break;
+  }
+  case BIMODE:
+  {
+    BimodePredictor *p = (BimodePredictor *)current;
+    t->counters[0] = &p->choice;
+    t->maps[0] = split_map;
+    t->counter_entries[0] = 1ULL << p->choice_bits;
+    t->counters[1] = &p->direction;
+    t->maps[1] = split_map;
+    t->counter_entries[1] = 2ULL << p->direction_bits;
+    t->num_counters = 2;
+    t->ghistory = &p->history;
+    break;
+  }
+  default:
+    break;
+  }
+}
 
-  // update lht based on actual outcome
-  if (outcome == TAKEN)
+int save_predictor_state(FILE *stream)
+{
+  predictor_state_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+  header.version = STATE_VERSION;
+  header.bpType = predictorType;
+  switch (predictorType)
   {
-    if (bht_lht[lht_index] < ST)
+  case GSHARE:
+    header.sizes[0] = ghistoryBitsGshare;
+    break;
+  case TOURNAMENT:
+    header.sizes[0] = ghistoryBitsTournament;
+    header.sizes[1] = lhistoryBitsTournament;
+    header.sizes[2] = chooserBitsTournament;
+    break;
+  case CUSTOM:
+    header.sizes[0] = ghistoryBitsCustom;
+    header.sizes[1] = lhistoryBitsCustom;
+    header.sizes[2] = chooserBitsCustom;
+    header.sizes[3] = historyLength;
+    header.sizes[4] = numPerceptrons;
+    break;
+  case TAGE:
+    header.sizes[0] = tageBaseBits;
+    header.sizes[1] = tageTables;
+    header.sizes[2] = tageTableBits;
+    header.sizes[3] = tageTagBits;
+    header.sizes[4] = tageMaxHistory;
+    break;
+  case PERCEPTRON:
+    header.sizes[0] = perceptronTables;
+    header.sizes[1] = perceptronTableBits;
+    header.sizes[2] = perceptronHistory;
+    break;
+  case PIECEWISE:
+    header.sizes[0] = piecewiseAddrBits;
+    header.sizes[1] = piecewisePathBits;
+    header.sizes[2] = piecewiseHistory;
+    break;
+  case YAGS:
+    header.sizes[0] = yagsChoiceBits;
+    header.sizes[1] = yagsSetBits;
+    header.sizes[2] = yagsTagBits;
+    header.sizes[3] = yagsWays;
+    break;
+  case BIMODE:
+    header.sizes[0] = choiceBitsBimode;
+    header.sizes[1] = directionBitsBimode;
+    break;
+  default:
+    break;
+  }
+  state_tables t;
+  list_tables(&t);
+  header.ghistory = (t.ghistory != NULL) ? *t.ghistory : 0;
+  header.globalHistory = (t.globalHistory != NULL) ? *t.globalHistory : 0;
+  if (fwrite(&header, sizeof(header), 1, stream) != 1)
+  {
+    return 0;
+  }
+
+  for (int i = 0; i < t.num_counters; i++)
+  {
+    if (!write_counters(stream, t.counters[i], t.maps[i], t.counter_entries[i]))
     {
-      bht_lht[lht_index]++;
+      return 0;
     }
   }
-  else
+  if (t.local_entries > 0 && fwrite(t.local, sizeof(uint64_t), t.local_entries, stream) != t.local_entries)
+  {
+    return 0;
+  }
+  if (t.num_weights > 0 && fwrite(t.weights, sizeof(int), t.num_weights, stream) != t.num_weights)
   {
-    if (bht_lht[lht_index] > SN)
+    return 0;
+  }
+  for (int i = 0; i < t.num_blocks; i++)
+  {
+    if (fwrite(t.blocks[i], 1, t.block_bytes[i], stream) != t.block_bytes[i])
     {
-      bht_lht[lht_index]--;
+      return 0;
     }
   }
-
-  // update local history
-  local_history[lht_index] = (local_history[lht_index] << 1) | outcome;
-
-  // update gshare ght
-  train_gshare(pc, outcome, ghistoryBitsTournament);
+  return 1;
 }
 
-void cleanup_tournament()
+int load_predictor_state(FILE *stream)
 {
-  free(bht_gshare);
-  free(bht_lht);
-  free(local_history);
-  free(selector);
-}
-//30, 130
-
-#define HISTORY_LENGTH 5
-#define NUM_PERCEPTRONS 5
-#define THRESHOLD (1.93 * HISTORY_LENGTH + 14)
-#define perceptron_threshold 250
+  predictor_state_header header;
+  if (fread(&header, sizeof(header), 1, stream) != 1 ||
+      memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 ||
+      header.version != STATE_VERSION || header.bpType > BIMODE)
+  {
+    return 0;
+  }
+  // The same limits as parse_config: table sizes up to 30 bits, the
+  // custom perceptron history up to 31 and its count up to 2^16.
+  // Perceptron and piecewise-linear sizes include a history length,
+  // and are checked below
+  for (int i = 0; i < 5 && header.bpType != PERCEPTRON && header.bpType != PIECEWISE; i++)
+  {
+    if (header.sizes[i] < 0 || header.sizes[i] > ((i < 3) ? 30 : (i == 3) ? 31 : (1 << 16)))
+    {
+      return 0;
+    }
+  }
 
-uint32_t globalHistory = 0;  
-int perceptrons[NUM_PERCEPTRONS][HISTORY_LENGTH + 1]; 
+  threadConfigured = 1;
+  predictorType = header.bpType;
+  switch (predictorType)
+  {
+  case GSHARE:
+    ghistoryBitsGshare = header.sizes[0];
+    break;
+  case TOURNAMENT:
+    ghistoryBitsTournament = header.sizes[0];
+    lhistoryBitsTournament = header.sizes[1];
+    chooserBitsTournament = header.sizes[2];
+    break;
+  case CUSTOM:
+    ghistoryBitsCustom = header.sizes[0];
+    lhistoryBitsCustom = header.sizes[1];
+    chooserBitsCustom = header.sizes[2];
+    historyLength = header.sizes[3];
+    numPerceptrons = header.sizes[4];
+    break;
+  case TAGE:
+    tageBaseBits = header.sizes[0];
+    tageTables = header.sizes[1];
+    tageTableBits = header.sizes[2];
+    tageTagBits = header.sizes[3];
+    tageMaxHistory = header.sizes[4];
+    if (!tage_config_valid())
+    {
+      return 0;
+    }
+    break;
+  case PERCEPTRON:
+    perceptronTables = header.sizes[0];
+    perceptronTableBits = header.sizes[1];
+    perceptronHistory = header.sizes[2];
+    if (!perceptron_config_valid())
+    {
+      return 0;
+    }
+    break;
+  case PIECEWISE:
+    piecewiseAddrBits = header.sizes[0];
+    piecewisePathBits = header.sizes[1];
+    piecewiseHistory = header.sizes[2];
+    if (!piecewise_config_valid())
+    {
+      return 0;
+    }
+    break;
+  case YAGS:
+    yagsChoiceBits = header.sizes[0];
+    yagsSetBits = header.sizes[1];
+    yagsTagBits = header.sizes[2];
+    yagsWays = header.sizes[3];
+    if (!yags_config_valid())
+    {
+      return 0;
+    }
+    break;
+  case BIMODE:
+    choiceBitsBimode = header.sizes[0];
+    directionBitsBimode = header.sizes[1];
+    if (!bimode_config_valid())
+    {
+      return 0;
+    }
+    break;
+  default:
+    break;
+  }
+  init_predictor();
 
-void init_perceptron() {
-    memset(perceptrons, 0, sizeof(perceptrons));
-}
+  state_tables t;
+  list_tables(&t);
+  if (t.ghistory != NULL)
+  {
+    *t.ghistory = header.ghistory;
+  }
+  if (t.globalHistory != NULL)
+  {
+    *t.globalHistory = header.globalHistory;
+  }
+  for (int i = 0; i < t.num_counters; i++)
+  {
+    if (!read_counters(stream, t.counters[i], t.maps[i], t.counter_entries[i]))
+    {
+      return 0;
+    }
+  }
+  if (t.local_entries > 0 && fread(t.local, sizeof(uint64_t), t.local_entries, stream) != t.local_entries)
+  {
+    return 0;
+  }
+  if (t.num_weights > 0 && fread(t.weights, sizeof(int), t.num_weights, stream) != t.num_weights)
+  {
+    return 0;
+  }
+  for (int i = 0; i < t.num_blocks; i++)
+  {
+    if (fread(t.blocks[i], 1, t.block_bytes[i], stream) != t.block_bytes[i])
+    {
+      return 0;
+    }
+  }
 
-uint8_t perceptron_prediction(uint32_t pc) {
-    int index = pc % NUM_PERCEPTRONS;
-    int y = perceptrons[index][0]; 
-    
-    for (int i = 0; i < HISTORY_LENGTH; i++) {
-        int historyBit = (globalHistory >> i) & 1;
-        y += perceptrons[index][i + 1] * (historyBit ? 1 : -1);
+  // The registers are read as they were in memory, and index the
+  // tables and histories, so check them before the first branch
+  switch (predictorType)
+  {
+  case TAGE:
+    return ((TagePredictor *)current)->registers_valid();
+  case PERCEPTRON:
+    return ((PerceptronPredictor *)current)->registers_valid();
+  case PIECEWISE:
+  {
+    PiecewisePredictor *p = (PiecewisePredictor *)current;
+    if (!p->registers_valid())
+    {
+      return 0;
     }
-    
-    return y >= 0 ? TAKEN : NOTTAKEN;
+    p->load_window();
+    return 1;
+  }
+  default:
+    return 1;
+  }
 }
 
-void train_perceptron(uint32_t pc, uint8_t outcome) {
-    int index = pc % NUM_PERCEPTRONS;
-    int y = perceptrons[index][0];
-    
-    for (int i = 0; i < HISTORY_LENGTH; i++) {
-        int historyBit = (globalHistory >> i) & 1;
-        y += perceptrons[index][i + 1] * (historyBit ? 1 : -1);
-    }
-    
-    int actual = outcome == TAKEN ? 1 : -1;
-    
-    if ((y >= 0) != (actual == 1) || abs(y) <= THRESHOLD) {
-        perceptrons[index][0] += actual;
-        for (int i = 0; i < HISTORY_LENGTH; i++) {
-            int historyBit = (globalHistory >> i) & 1;
-            perceptrons[index][i + 1] += actual * (historyBit ? 1 : -1);
-        }
+// The local history registers are updated but never read by the
+// predictions, so they are not counted. The custom perceptron weights
+// are not saturated, so each is charged the 32 bits of its int. TAGE
+// adds to its tables the history up to its longest length, the path
+// history, the 4-bit use-alternate counter and the 18-bit reset
+// counter. The hashed perceptron adds its history, an 8-bit threshold
+// and its 7-bit threshold counter to the weights, and the
+// piecewise-linear predictor the outcome and path address of each
+// branch in its history. A YAGS cache entry holds its tag, a 2-bit
+// counter, a valid bit and the bits of its LRU age, and the global
+// history spans the set index.
+//
+uint64_t predictor_storage_bits()
+{
+  switch (predictorType)
+  {
+  case GSHARE:
+    return 2 * (1ULL << ghistoryBitsGshare) + ghistoryBitsGshare;
+  case TOURNAMENT:
+    return 2 * ((1ULL << ghistoryBitsTournament) + (1ULL << lhistoryBitsTournament) + (1ULL << chooserBitsTournament)) +
+           ghistoryBitsTournament;
+  case CUSTOM:
+    return 2 * ((1ULL << ghistoryBitsCustom) + (1ULL << lhistoryBitsCustom) + (1ULL << chooserBitsCustom)) +
+           ghistoryBitsCustom + 32ULL * numPerceptrons * (historyLength + 1) + historyLength;
+  case TAGE:
+    return 2 * (1ULL << tageBaseBits) +
+           ((uint64_t)tageTables << tageTableBits) * (TAGE_CTR_BITS + TAGE_U_BITS + tageTagBits) + tageMaxHistory +
+           TAGE_PATH_BITS + 4 + 18;
+  case PERCEPTRON:
+    return 8 * ((uint64_t)perceptronTables << perceptronTableBits) + perceptronHistory + 8 + 7;
+  case PIECEWISE:
+    return 8 * ((1ULL << piecewiseAddrBits) * (1 + ((uint64_t)piecewiseHistory << piecewisePathBits))) +
+           (uint64_t)piecewiseHistory * (1 + piecewisePathBits);
+  case YAGS:
+  {
+    int age_bits = 0;
+    while ((1 << age_bits) < yagsWays)
+    {
+      age_bits++;
     }
-    
-    globalHistory = ((globalHistory << 1) | (outcome == TAKEN ? 1 : 0)) & ((1ULL << HISTORY_LENGTH) - 1); 
+    return 2 * (1ULL << yagsChoiceBits) +
+           2 * ((uint64_t)yagsWays << yagsSetBits) * (yagsTagBits + 2 + 1 + age_bits) + yagsSetBits;
+  }
+  case BIMODE:
+    return 2 * ((1ULL << choiceBitsBimode) + (2ULL << directionBitsBimode)) + directionBitsBimode;
+  default:
+    return 0;
+  }
 }
 
-void init_custom()
+int predictor_alias_stats(alias_stats *stats)
 {
-  init_perceptron();
-  //entries
-  int bht_entries = 1 << ghistoryBitsCustom;
-  int lht_entries = 1 << lhistoryBitsCustom;
-  int selector_entries = 1 << chooserBitsCustom;
-
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  bht_lht = (uint8_t *)malloc(lht_entries * sizeof(uint8_t)); 
-  local_history = (uint64_t *)malloc(lht_entries * sizeof(uint64_t)); // Local history registers
+  AliasCounter *aliases = NULL;
+  switch (predictorType)
+  {
+  case GSHARE:
+    aliases = &((GsharePredictor *)current)->aliases;
+    break;
+  case BIMODE:
+    aliases = &((BimodePredictor *)current)->aliases;
+    break;
+  default:
+    break;
+  }
+  if (aliases == NULL || aliases->owners == NULL)
+  {
+    return 0;
+  }
+  *stats = aliases->stats;
+  return 1;
+}
 
-  selector = (uint8_t *)malloc(selector_entries * sizeof(uint8_t)); // Selector table 
+//------------------------------------//
+//         Batched Simulation         //
+//------------------------------------//
 
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
+// Dispatch once per batch rather than twice per branch, to a loop
+// built for the predictor class
+//
+void simulate_batch(const trace_batch *batch, uint8_t *predictions, uint32_t *num_branches, uint32_t *mispredictions)
+{
+  switch (predictorType)
   {
-    bht_gshare[i] = WN;  
-  }
-  for (i = 0; i< lht_entries; i++)
+  case STATIC:
   {
-    bht_lht[i] = WN;    
-    local_history[i] = 0; 
+    StaticPredictor p;
+    p.simulate(batch, predictions, num_branches, mispredictions);
+    return;
   }
-  for (i = 0; i< selector_entries; i++)
+  case GSHARE:
+    ((GsharePredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case TOURNAMENT:
+    ((TournamentPredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case CUSTOM:
+    ((CustomPredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case TAGE:
+    ((TagePredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case PERCEPTRON:
+    ((PerceptronPredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case PIECEWISE:
+    ((PiecewisePredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case YAGS:
+    ((YagsPredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  case BIMODE:
+    ((BimodePredictor *)current)->simulate(batch, predictions, num_branches, mispredictions);
+    return;
+  default:
+    break;
+  }
+
+  // Any other type goes through make_prediction and train_predictor
+  const uint32_t *pcs = batch->pc;
+  const uint8_t *flags = batch->flags;
+  uint32_t n = 0, miss = 0;
+  for (size_t i = 0; i < batch->count; i++)
   {
-    selector[i] = WN;  
+    uint32_t outcome = flags[i] & BR_OUTCOME;
+    uint32_t condition = (flags[i] & BR_CONDITION) ? 1 : 0;
+    uint32_t call = (flags[i] & BR_CALL) ? 1 : 0;
+    uint32_t ret = (flags[i] & BR_RET) ? 1 : 0;
+    uint32_t direct = (flags[i] & BR_DIRECT) ? 1 : 0;
+    if (condition)
+    {
+      uint32_t prediction = make_prediction(pcs[i], batch->target[i], direct);
+      if (predictions != NULL)
+      {
+        predictions[n] = prediction;
+      }
+      n++;
+      miss += (prediction != outcome);
+    }
+    train_predictor(pcs[i], batch->target[i], outcome, condition, call, ret, direct);
   }
 
-  ghistory = 0; 
+  *num_branches += n;
+  *mispredictions += miss;
 }
 
-uint32_t custom_predict(uint32_t pc)
-{
-  uint32_t gshare_index = (pc ^ ghistory) & ((1 << ghistoryBitsCustom) - 1);
-  uint32_t lht_index = pc & ((1 << lhistoryBitsCustom) - 1);
-  uint32_t selector_index = (pc ^ ghistory) & ((1 << chooserBitsCustom) - 1);
-
-  //make two predictions
-  uint8_t gshare_prediction = (bht_gshare[gshare_index] >= WT) ? TAKEN : NOTTAKEN;
-  uint8_t lht_prediction = (bht_lht[lht_index] >= WT) ? TAKEN : NOTTAKEN;
-  uint8_t perceptron_pred = perceptron_prediction(pc);
+//------------------------------------//
+//            Gshare Lanes            //
+//------------------------------------//
 
-  //selector prediction
-  uint8_t selector_value = selector[selector_index];
+int gshareLanes = -1;
 
-  uint8_t final_prediction = 0;
+static int pick_lanes()
+{
+  if (gshareLanes < 0)
+  {
+#ifdef __SSE2__
+    __builtin_cpu_init();
+    gshareLanes = __builtin_cpu_supports("avx2") ? LANES_AVX2 : LANES_SCALAR;
+#else
+    gshareLanes = LANES_SCALAR;
+#endif
+  }
+#ifndef __SSE2__
+  if (gshareLanes == LANES_AVX2)
+  {
+    gshareLanes = LANES_SCALAR;
+  }
+#endif
+  return gshareLanes;
+}
 
-  //choose gshare or lht prediction based on selecgtor
-  if (gshare_prediction == lht_prediction){
-    return (selector_value >= WT) ? gshare_prediction : lht_prediction;
-  } else {
-    //return (selector_value >= WT) ? gshare_prediction : lht_prediction;
-    if ((pc & 0xFF) > perceptron_threshold){
-      final_prediction = (gshare_prediction + lht_prediction + (perceptron_pred >> 2)) / 2;
-      return final_prediction >= 0 ? TAKEN : NOTTAKEN;
+// Tables of the lanes of one pass over a batch. Lanes past the
+// last predictor, up to a whole vector, count into a scratch word.
+typedef struct
+{
+  int num_lanes;
+  uint64_t *words[GSHARE_LANES];
+  uint64_t masks[GSHARE_LANES];
+  uint32_t misses[GSHARE_LANES];
+  uint64_t scratch[GSHARE_LANES];
+} gshare_lanes;
+
+static uint64_t run_lanes_scalar(gshare_lanes *g, const trace_batch *batch, uint64_t history, uint32_t *num_branches)
+{
+  uint32_t n = 0;
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if (!(batch->flags[i] & BR_CONDITION))
+    {
+      continue;
+    }
+    uint8_t outcome = batch->flags[i] & BR_OUTCOME;
+    uint32_t x = batch->pc[i] ^ (uint32_t)history;
+    for (int l = 0; l < g->num_lanes; l++)
+    {
+      Counters table = {g->words[l]};
+      uint64_t counter = table.step(x & g->masks[l], outcome);
+      g->misses[l] += (Counters::taken(counter) ? TAKEN : NOTTAKEN) != outcome;
     }
-    return (selector_value >= WT) ? gshare_prediction : lht_prediction;
+    history = (history << 1) | outcome;
+    n++;
   }
+  *num_branches = n;
+  return history;
 }
 
-void train_custom(uint32_t pc, uint8_t outcome)
+#ifdef __SSE2__
+// Four lanes per vector: gather the word of each lane's counter,
+// step the counters in their words and store the words back. Tables
+// are addressed as byte offsets from the first lane's, since they
+// are separate allocations.
+//
+__attribute__((target("avx2"))) static uint64_t run_lanes_avx2(gshare_lanes *g, const trace_batch *batch,
+                                                                uint64_t history, uint32_t *num_branches)
 {
-  train_perceptron(pc, outcome);
-  uint32_t bht_entries = 1 << ghistoryBitsCustom;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-
-  uint32_t gshare_index = pc_lower_bits ^ ghistory_lower_bits;
-  uint32_t lht_index = pc_lower_bits;
-
-  //make two predictions
-  uint8_t gshare_prediction = gshare_predict(pc, ghistoryBitsCustom);
-  uint8_t lht_prediction = (bht_lht[lht_index] == WT || bht_lht[lht_index] == ST) ? TAKEN : NOTTAKEN;
-  uint8_t perceptron_pred = perceptron_prediction(pc);
-
-  uint32_t selector_index = (pc ^ ghistory) & ((1 << chooserBitsCustom) - 1);
+  const int vectors = (g->num_lanes + 3) / 4;
+  const char *base = (const char *)g->words[0];
+  __m256i offsets[GSHARE_LANES / 4], masks[GSHARE_LANES / 4], misses[GSHARE_LANES / 4];
+  for (int v = 0; v < vectors; v++)
+  {
+    offsets[v] = _mm256_setr_epi64x((const char *)g->words[4 * v] - base, (const char *)g->words[4 * v + 1] - base,
+                                    (const char *)g->words[4 * v + 2] - base, (const char *)g->words[4 * v + 3] - base);
+    masks[v] = _mm256_loadu_si256((const __m256i *)&g->masks[4 * v]);
+    misses[v] = _mm256_setzero_si256();
+  }
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i max = _mm256_set1_epi64x(Counters::MAX);
+  const __m256i in_word = _mm256_set1_epi64x(Counters::PER_WORD - 1);
 
-  // Update selector based on otucome for each selector and actual outcome
-  if (gshare_prediction == outcome && lht_prediction != outcome) //if gshare is correct and local is wrong
+  uint32_t n = 0;
+  for (size_t i = 0; i < batch->count; i++)
   {
-    if (selector[selector_index] < ST)
+    if (!(batch->flags[i] & BR_CONDITION))
     {
-      selector[selector_index]++; //increment gshare priority
+      continue;
     }
-  }
-  else if (lht_prediction == outcome && gshare_prediction != outcome) // if local is correct and gshare is wrong
-  {
-    if (selector[selector_index] > SN)
+    uint8_t outcome = batch->flags[i] & BR_OUTCOME;
+    __m256i taken = _mm256_set1_epi64x(-(int64_t)outcome);
+    __m256i x = _mm256_set1_epi64x(batch->pc[i] ^ (uint32_t)history);
+    for (int v = 0; v < vectors; v++)
     {
-      selector[selector_index]--; //decrement gshare priority
+      __m256i slot = _mm256_and_si256(x, masks[v]);
+      __m256i addr = _mm256_add_epi64(offsets[v], _mm256_slli_epi64(_mm256_srli_epi64(slot, 5), 3));
+      __m256i word = _mm256_i64gather_epi64((const long long *)base, addr, 1);
+      __m256i shift = _mm256_slli_epi64(_mm256_and_si256(slot, in_word), 1);
+      __m256i value = _mm256_and_si256(_mm256_srlv_epi64(word, shift), max);
+
+      // +1 unless saturated for taken, -1 unless zero otherwise
+      __m256i up = _mm256_add_epi64(one, _mm256_cmpeq_epi64(value, max));
+      __m256i down = _mm256_sub_epi64(zero, _mm256_add_epi64(one, _mm256_cmpeq_epi64(value, zero)));
+      __m256i delta = _mm256_blendv_epi8(down, up, taken);
+      word = _mm256_add_epi64(word, _mm256_sllv_epi64(delta, shift));
+      misses[v] = _mm256_add_epi64(misses[v], _mm256_xor_si256(_mm256_srli_epi64(value, 1), _mm256_and_si256(taken, one)));
+
+      *(uint64_t *)(base + _mm256_extract_epi64(addr, 0)) = _mm256_extract_epi64(word, 0);
+      *(uint64_t *)(base + _mm256_extract_epi64(addr, 1)) = _mm256_extract_epi64(word, 1);
+      *(uint64_t *)(base + _mm256_extract_epi64(addr, 2)) = _mm256_extract_epi64(word, 2);
+      *(uint64_t *)(base + _mm256_extract_epi64(addr, 3)) = _mm256_extract_epi64(word, 3);
     }
+    history = (history << 1) | outcome;
+    n++;
   }
 
-  // update lht based on actual outcome
-  if (outcome == TAKEN)
+  for (int v = 0; v < vectors; v++)
   {
-    if (bht_lht[lht_index] < ST)
+    uint64_t counts[4];
+    _mm256_storeu_si256((__m256i *)counts, misses[v]);
+    for (int l = 0; l < 4; l++)
     {
-      bht_lht[lht_index]++;
+      g->misses[4 * v + l] += counts[l];
     }
   }
-  else
+  *num_branches = n;
+  return history;
+}
+#endif
+
+void simulate_gshare_lanes(const trace_batch *batch, predictor_context *contexts, const int *lanes, int num_lanes,
+                           uint32_t *num_branches, uint32_t *mispredictions)
+{
+  gshare_lanes g;
+  memset(&g, 0, sizeof(g));
+  g.num_lanes = num_lanes;
+  for (int l = 0; l < GSHARE_LANES; l++)
   {
-    if (bht_lht[lht_index] > SN)
+    if (l < num_lanes)
     {
-      bht_lht[lht_index]--;
+      GsharePredictor *p = (GsharePredictor *)contexts[lanes[l]].instance;
+      g.words[l] = p->bht.words;
+      g.masks[l] = p->mask;
+    }
+    else
+    {
+      g.words[l] = &g.scratch[l];
     }
   }
 
-  // update local history
-  local_history[lht_index] = (local_history[lht_index] << 1) | outcome;
+  GsharePredictor *first = (GsharePredictor *)contexts[lanes[0]].instance;
+  uint64_t history;
+#ifdef __SSE2__
+  if (pick_lanes() == LANES_AVX2)
+  {
+    history = run_lanes_avx2(&g, batch, first->history, num_branches);
+  }
+  else
+#endif
+  {
+    history = run_lanes_scalar(&g, batch, first->history, num_branches);
+  }
 
-  // update gshare ght
-  train_gshare(pc, outcome, ghistoryBitsCustom);
+  for (int l = 0; l < num_lanes; l++)
+  {
+    ((GsharePredictor *)contexts[lanes[l]].instance)->history = history;
+    mispredictions[lanes[l]] += g.misses[l];
+  }
 }
 
+//------------------------------------//
+//         Sharded Simulation         //
+//------------------------------------//
 
+// Tables of a sharded run, replayed in this order: the selector needs
+// the gshare and local predictions of every branch first
+enum
+{
+  SHARD_GSHARE,
+  SHARD_LOCAL,
+  SHARD_PERCEPTRON,
+  SHARD_SELECTOR,
+  SHARD_TABLES
+};
+
+// Conditional branches per chunk of the index and partition passes,
+// and shards per thread, so that uneven shards still keep every
+// thread busy
+#define SHARD_CHUNK (1 << 16)
+#define SHARDS_PER_THREAD 4
+
+typedef struct
+{
+  const uint32_t *pcs;
+  const uint8_t *outcomes;
+  uint32_t count;
+
+  // Tables of the current predictor. The gshare predictor has its bht
+  // alone, under split_map.
+  Counters *gshare;
+  slot_map gshare_map;
+  uint32_t gmask;
+  TournamentTables *tables; // NULL for gshare
+  CustomPredictor *custom;  // NULL unless custom
+  int used[SHARD_TABLES];
+  int final_table; // whose replay makes the predictions
+
+  // Histories at the start of each chunk, and per branch its table
+  // slots, perceptron history and the predictions of the tables
+  // feeding the selector
+  int num_chunks;
+  uint64_t *chunk_history;
+  uint32_t *chunk_perceptron_history;
+  uint32_t *gshare_slots;
+  uint32_t *selector_slots;
+  uint32_t *perceptron_history;
+  uint8_t *taken[SHARD_SELECTOR];
+  uint8_t *predictions;
+
+  // Branches of each table, shard by shard in trace order:
+  // branches[t][starts[t][s], starts[t][s + 1]) for shard s. counts
+  // holds the branches of each (chunk, table, shard), then where the
+  // chunk writes them.
+  int num_shards;
+  uint32_t *counts;
+  uint32_t *branches[SHARD_TABLES];
+  uint32_t *starts[SHARD_TABLES];
+  uint32_t *misses; // of each (table, shard) job
+} shard_run;
+
+// 'history' after shifting in outcomes[0, i)
+//
+static uint64_t history_at(uint64_t history, const uint8_t *outcomes, uint32_t i)
+{
+  for (uint32_t j = (i > 64) ? i - 64 : 0; j < i; j++)
+  {
+    history = (history << 1) | outcomes[j];
+  }
+  return history;
+}
 
-
-void init_predictor()
+// Shard of 'table' that branch i uses: tables are dealt out to the
+// shards a cache line of counters at a time, so no two shards write
+// the same word
+//
+static uint32_t shard_of(const shard_run *r, int table, uint32_t i)
 {
-  switch (bpType)
+  uint32_t key;
+  switch (table)
   {
-  case STATIC:
+  case SHARD_GSHARE:
+    key = r->gshare_slots[i] >> LINE_BITS;
     break;
-  case GSHARE:
-    init_gshare(ghistoryBitsGshare);
+  case SHARD_LOCAL:
+    key = (r->pcs[i] & r->tables->lmask) >> LINE_BITS;
     break;
-  case TOURNAMENT:
-    init_tournament(); 
-    break;
-  case CUSTOM:
-    init_custom();
+  case SHARD_PERCEPTRON:
+    key = r->pcs[i] % r->custom->numPerceptrons;
     break;
   default:
+    key = r->selector_slots[i] >> LINE_BITS;
     break;
   }
+  return key & (r->num_shards - 1);
 }
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
+// First pass over a chunk: the slots of its branches, and how many
+// fall in each shard
 //
-uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+static void index_chunk(int chunk, void *arg)
 {
+  shard_run *r = (shard_run *)arg;
+  uint32_t begin = (uint32_t)chunk * SHARD_CHUNK;
+  uint32_t end = (r->count - begin > SHARD_CHUNK) ? begin + SHARD_CHUNK : r->count;
+  uint64_t history = r->chunk_history[chunk];
+  uint32_t perceptron_history = r->chunk_perceptron_history[chunk];
+  uint32_t perceptron_mask = (r->custom != NULL) ? (uint32_t)((1ULL << r->custom->historyLength) - 1) : 0;
+
+  for (uint32_t i = begin; i < end; i++)
+  {
+    uint32_t pc = r->pcs[i];
+    r->gshare_slots[i] = map_slot(r->gshare_map, (pc ^ (uint32_t)history) & r->gmask);
+    if (r->tables != NULL)
+    {
+      r->selector_slots[i] = map_slot(r->tables->selector_map, (pc ^ (uint32_t)history) & r->tables->cmask);
+    }
+    if (r->custom != NULL)
+    {
+      r->perceptron_history[i] = perceptron_history;
+      perceptron_history = ((perceptron_history << 1) | r->outcomes[i]) & perceptron_mask;
+    }
+    history = (history << 1) | r->outcomes[i];
+  }
 
-  // Make a prediction based on the bpType
-  switch (bpType)
+  uint32_t *counts = &r->counts[(size_t)chunk * SHARD_TABLES * r->num_shards];
+  for (int t = 0; t < SHARD_TABLES; t++)
   {
-  case STATIC:
-    return TAKEN;
-  case GSHARE:
-    return gshare_predict(pc, ghistoryBitsGshare);
-  case TOURNAMENT:
-    return tournament_predict(pc);
-  case CUSTOM:
-    return custom_predict(pc);
+    for (uint32_t i = begin; r->used[t] && i < end; i++)
+    {
+      counts[t * r->num_shards + shard_of(r, t, i)]++;
+    }
+  }
+}
+
+// Second pass over a chunk: append its branches to their shards
+//
+static void partition_chunk(int chunk, void *arg)
+{
+  shard_run *r = (shard_run *)arg;
+  uint32_t begin = (uint32_t)chunk * SHARD_CHUNK;
+  uint32_t end = (r->count - begin > SHARD_CHUNK) ? begin + SHARD_CHUNK : r->count;
+  uint32_t *next = &r->counts[(size_t)chunk * SHARD_TABLES * r->num_shards];
+  for (int t = 0; t < SHARD_TABLES; t++)
+  {
+    for (uint32_t i = begin; r->used[t] && i < end; i++)
+    {
+      r->branches[t][next[t * r->num_shards + shard_of(r, t, i)]++] = i;
+    }
+  }
+}
+
+// Replay the branches of one shard of one table in trace order
+//
+static void replay_shard(int job, void *arg)
+{
+  shard_run *r = (shard_run *)arg;
+  int table = job / r->num_shards;
+  int shard = job % r->num_shards;
+  const uint32_t *branches = r->branches[table];
+  uint32_t begin = r->starts[table][shard];
+  uint32_t end = r->starts[table][shard + 1];
+  uint8_t *predictions = (table == r->final_table) ? r->predictions : NULL;
+  uint32_t miss = 0;
+
+  switch (table)
+  {
+  case SHARD_GSHARE:
+    for (uint32_t k = begin; k < end; k++)
+    {
+      uint32_t i = branches[k];
+      uint8_t prediction = Counters::taken(r->gshare->step(r->gshare_slots[i], r->outcomes[i])) ? TAKEN : NOTTAKEN;
+      if (r->tables != NULL)
+      {
+        r->taken[SHARD_GSHARE][i] = prediction;
+      }
+      else
+      {
+        miss += (prediction != r->outcomes[i]);
+        if (predictions != NULL)
+        {
+          predictions[i] = prediction;
+        }
+      }
+    }
+    break;
+  case SHARD_LOCAL:
+    for (uint32_t k = begin; k < end; k++)
+    {
+      uint32_t i = branches[k];
+      uint32_t lht_index = r->pcs[i] & r->tables->lmask;
+      r->taken[SHARD_LOCAL][i] = Counters::taken(r->tables->bht_lht.step(lht_index, r->outcomes[i])) ? TAKEN : NOTTAKEN;
+      r->tables->local_history[lht_index] = (r->tables->local_history[lht_index] << 1) | r->outcomes[i];
+    }
+    break;
+  case SHARD_PERCEPTRON:
+  {
+    // A copy whose globalHistory is set to each branch's, sharing the
+    // weights of the current predictor
+    CustomPredictor p = *r->custom;
+    for (uint32_t k = begin; k < end; k++)
+    {
+      uint32_t i = branches[k];
+      p.globalHistory = r->perceptron_history[i];
+      int y = p.perceptron_output(r->pcs[i]);
+      r->taken[SHARD_PERCEPTRON][i] = (y >= 0) ? TAKEN : NOTTAKEN;
+      p.train_perceptron(r->pcs[i], y, r->outcomes[i]);
+    }
+    break;
+  }
   default:
+    for (uint32_t k = begin; k < end; k++)
+    {
+      uint32_t i = branches[k];
+      uint32_t slot = r->selector_slots[i];
+      uint64_t selector_counter = r->tables->selector.get(slot);
+      uint8_t gshare_prediction = r->taken[SHARD_GSHARE][i];
+      uint8_t lht_prediction = r->taken[SHARD_LOCAL][i];
+      uint32_t prediction;
+      if (r->custom != NULL)
+      {
+        prediction = CustomPredictor::combine(r->pcs[i], gshare_prediction, lht_prediction,
+                                              r->taken[SHARD_PERCEPTRON][i], selector_counter);
+      }
+      else
+      {
+        prediction = Counters::taken(selector_counter) ? gshare_prediction : lht_prediction;
+      }
+      r->tables->train_selector(slot, gshare_prediction, lht_prediction, selector_counter, r->outcomes[i]);
+      miss += (prediction != r->outcomes[i]);
+      if (predictions != NULL)
+      {
+        predictions[i] = prediction;
+      }
+    }
     break;
   }
 
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+  r->misses[job] = miss;
 }
 
-// Train the predictor the last executed branch at PC 'pc' and with
-// outcome 'outcome' (true indicates that the branch was taken, false
-// indicates that the branch was not taken)
+static shard_run *sort_run;
+
+static int compare_shard_size(const void *a, const void *b)
+{
+  int x = *(const int *)a, y = *(const int *)b;
+  int n = sort_run->num_shards;
+  uint32_t size_x = sort_run->starts[x / n][x % n + 1] - sort_run->starts[x / n][x % n];
+  uint32_t size_y = sort_run->starts[y / n][y % n + 1] - sort_run->starts[y / n][y % n];
+  return (size_x < size_y) - (size_x > size_y);
+}
+
+// Replay every shard of the tables [first, last) that the run uses,
+// largest first
 //
+static void replay_tables(shard_run *r, int first, int last, int threads)
+{
+  int *order = (int *)malloc(SHARD_TABLES * r->num_shards * sizeof(int));
+  int num_jobs = 0;
+  for (int t = first; t < last; t++)
+  {
+    for (int s = 0; r->used[t] && s < r->num_shards; s++)
+    {
+      order[num_jobs++] = t * r->num_shards + s;
+    }
+  }
+  sort_run = r;
+  qsort(order, num_jobs, sizeof(int), compare_shard_size);
+  job_pool_run(threads, order, num_jobs, replay_shard, r);
+  free(order);
+}
 
-void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+void simulate_sharded(const uint32_t *pcs, const uint8_t *outcomes, uint32_t count, int threads,
+                      uint8_t *predictions, uint32_t *mispredictions)
 {
-  if (condition)
+  if (predictorType != GSHARE && predictorType != TOURNAMENT && predictorType != CUSTOM)
   {
-    switch (bpType)
+    // The static predictor has no tables, a TAGE branch may allocate
+    // in any tagged table, a perceptron sums weights of every table,
+    // a piecewise-linear weight is picked by the path, a YAGS branch
+    // evicts other branches from its set and a bi-mode direction
+    // table is picked by a counter that changes as the trace runs, so
+    // these run in order
+    for (uint32_t i = 0; i < count; i++)
     {
-    case STATIC:
-      return;
-    case GSHARE:
-      return train_gshare(pc, outcome, ghistoryBitsGshare);
-    case TOURNAMENT:
-      return train_tournament(pc, outcome);
-    case CUSTOM:
-      return train_custom(pc, outcome);
-    default:
-      break;
+      uint32_t prediction = predict_and_update(pcs[i], 0, BR_CONDITION, outcomes[i]);
+      if (predictions != NULL)
+      {
+        predictions[i] = prediction;
+      }
+      *mispredictions += (prediction != outcomes[i]);
+    }
+    return;
+  }
+
+  shard_run r;
+  memset(&r, 0, sizeof(r));
+  r.pcs = pcs;
+  r.outcomes = outcomes;
+  r.count = count;
+  r.predictions = predictions;
+  uint64_t history;
+  if (predictorType == GSHARE)
+  {
+    GsharePredictor *p = (GsharePredictor *)current;
+    r.gshare = &p->bht;
+    r.gshare_map = split_map;
+    r.gmask = p->mask;
+    history = p->history;
+    r.final_table = SHARD_GSHARE;
+  }
+  else
+  {
+    r.tables = tournament_tables();
+    r.custom = (predictorType == CUSTOM) ? (CustomPredictor *)current : NULL;
+    r.gshare = &r.tables->bht_gshare;
+    r.gshare_map = r.tables->gshare_map;
+    r.gmask = r.tables->gmask;
+    history = r.tables->ghistory;
+    r.used[SHARD_LOCAL] = r.used[SHARD_SELECTOR] = 1;
+    r.used[SHARD_PERCEPTRON] = (r.custom != NULL);
+    r.final_table = SHARD_SELECTOR;
+  }
+  r.used[SHARD_GSHARE] = 1;
+
+  r.num_shards = 1;
+  while (r.num_shards < threads * SHARDS_PER_THREAD)
+  {
+    r.num_shards <<= 1;
+  }
+  r.num_chunks = (count + SHARD_CHUNK - 1) / SHARD_CHUNK;
+  r.chunk_history = (uint64_t *)malloc(r.num_chunks * sizeof(uint64_t));
+  r.chunk_perceptron_history = (uint32_t *)calloc(r.num_chunks, sizeof(uint32_t));
+  for (int c = 0; c < r.num_chunks; c++)
+  {
+    r.chunk_history[c] = history_at(history, outcomes, (uint32_t)c * SHARD_CHUNK);
+    if (r.custom != NULL)
+    {
+      r.chunk_perceptron_history[c] = history_at(r.custom->globalHistory, outcomes, (uint32_t)c * SHARD_CHUNK) &
+                                      (uint32_t)((1ULL << r.custom->historyLength) - 1);
+    }
+  }
+  r.gshare_slots = (uint32_t *)malloc(count * sizeof(uint32_t));
+  if (r.tables != NULL)
+  {
+    r.selector_slots = (uint32_t *)malloc(count * sizeof(uint32_t));
+    r.taken[SHARD_GSHARE] = (uint8_t *)malloc(count);
+    r.taken[SHARD_LOCAL] = (uint8_t *)malloc(count);
+  }
+  if (r.custom != NULL)
+  {
+    r.perceptron_history = (uint32_t *)malloc(count * sizeof(uint32_t));
+    r.taken[SHARD_PERCEPTRON] = (uint8_t *)malloc(count);
+  }
+  r.counts = (uint32_t *)calloc((size_t)r.num_chunks * SHARD_TABLES * r.num_shards, sizeof(uint32_t));
+  r.misses = (uint32_t *)calloc(SHARD_TABLES * r.num_shards, sizeof(uint32_t));
+
+  // Index the chunks, then turn their counts into where each chunk
+  // starts in every shard and partition them
+  int *chunks = (int *)malloc(r.num_chunks * sizeof(int));
+  for (int c = 0; c < r.num_chunks; c++)
+  {
+    chunks[c] = c;
+  }
+  job_pool_run(threads, chunks, r.num_chunks, index_chunk, &r);
+  for (int t = 0; t < SHARD_TABLES; t++)
+  {
+    if (!r.used[t])
+    {
+      continue;
+    }
+    r.branches[t] = (uint32_t *)malloc(count * sizeof(uint32_t));
+    r.starts[t] = (uint32_t *)malloc((r.num_shards + 1) * sizeof(uint32_t));
+    uint32_t total = 0;
+    for (int s = 0; s < r.num_shards; s++)
+    {
+      r.starts[t][s] = total;
+      for (int c = 0; c < r.num_chunks; c++)
+      {
+        uint32_t *n = &r.counts[((size_t)c * SHARD_TABLES + t) * r.num_shards + s];
+        uint32_t chunk_count = *n;
+        *n = total;
+        total += chunk_count;
+      }
+    }
+    r.starts[t][r.num_shards] = total;
+  }
+  job_pool_run(threads, chunks, r.num_chunks, partition_chunk, &r);
+
+  // Replay the tables, and the selector once the rest are done
+  replay_tables(&r, SHARD_GSHARE, SHARD_SELECTOR, threads);
+  replay_tables(&r, SHARD_SELECTOR, SHARD_TABLES, threads);
+  for (int s = 0; s < r.num_shards; s++)
+  {
+    *mispredictions += r.misses[r.final_table * r.num_shards + s];
+  }
+
+  // Leave the histories where the sequential loop would
+  history = history_at(history, outcomes, count);
+  if (predictorType == GSHARE)
+  {
+    ((GsharePredictor *)current)->history = history;
+  }
+  else
+  {
+    r.tables->ghistory = history;
+  }
+  if (r.custom != NULL)
+  {
+    r.custom->globalHistory = history_at(r.custom->globalHistory, outcomes, count) &
+                              (uint32_t)((1ULL << r.custom->historyLength) - 1);
+  }
+
+  free(chunks);
+  free(r.chunk_history);
+  free(r.chunk_perceptron_history);
+  free(r.gshare_slots);
+  free(r.selector_slots);
+  free(r.perceptron_history);
+  for (int t = 0; t < SHARD_TABLES; t++)
+  {
+    if (t < SHARD_SELECTOR)
+    {
+      free(r.taken[t]);
     }
+    free(r.branches[t]);
+    free(r.starts[t]);
   }
+  free(r.counts);
+  free(r.misses);
 }
@@ -70,6 +70,276 @@ void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t co
 // Please add your code below, and DO NOT MODIFY ANY OF THE CODE ABOVE
 // 
 
+#include <stdio.h>
+#include "trace.h"
 
+// The predictor types added to those above
+#define TAGE 4
+#define PERCEPTRON 5
+#define PIECEWISE 6
+#define YAGS 7
+#define BIMODE 8
+
+// Type of this thread's predictor. The predictor functions read this
+// rather than bpType above, so that every thread of a --jobs run has
+// a predictor of its own. Until parse_config, load_predictor or
+// load_predictor_state sets threadConfigured, init_predictor takes
+// the type from bpType and the local history size from lhistoryBits,
+// as the original interface sets them.
+extern thread_local int predictorType;
+extern thread_local int threadConfigured;
+
+// Table sizes of the predictors (log2 of their entries). The
+// tournament's local history size is lhistoryBitsTournament, a
+// per-thread copy of lhistoryBits above for the same reason.
+extern thread_local int ghistoryBitsGshare;
+extern thread_local int ghistoryBitsTournament;
+extern thread_local int lhistoryBitsTournament;
+extern thread_local int chooserBitsTournament;
+extern thread_local int ghistoryBitsCustom;
+extern thread_local int lhistoryBitsCustom;
+extern thread_local int chooserBitsCustom;
+extern thread_local int historyLength;  // of the custom perceptrons (<= 31)
+extern thread_local int numPerceptrons;
+extern thread_local int choiceBitsBimode;
+extern thread_local int directionBitsBimode;
+
+// Returns True if the bi-mode sizes of the current configuration are
+// in range
+//
+int bimode_config_valid();
+
+// TAGE base table size, tagged table count and size (log2 entries),
+// tag width and longest history (see TagePredictor)
+extern thread_local int tageBaseBits;
+extern thread_local int tageTables;
+extern thread_local int tageTableBits;
+extern thread_local int tageTagBits;
+extern thread_local int tageMaxHistory;
+#define TAGE_MAX_TABLES 12
+#define TAGE_HISTORY_BUFFER 2048
+#define TAGE_MAX_HISTORY (TAGE_HISTORY_BUFFER / 2)
+
+// Returns True if the TAGE sizes of the current configuration are in
+// range
+//
+int tage_config_valid();
+
+// Weight tables of the hashed perceptron, their size (log2 entries)
+// and the global history they cover (see PerceptronPredictor)
+extern thread_local int perceptronTables;
+extern thread_local int perceptronTableBits;
+extern thread_local int perceptronHistory;
+#define PERCEPTRON_MAX_TABLES 32
+#define PERCEPTRON_HISTORY_BUFFER 2048
+#define PERCEPTRON_MAX_HISTORY (PERCEPTRON_HISTORY_BUFFER / 2)
+
+// Returns True if the perceptron sizes of the current configuration
+// are in range
+//
+int perceptron_config_valid();
+
+// Piecewise-linear predictor: bits of the branch address and of each
+// path address that select its weights, and the history it covers
+// (see PiecewisePredictor)
+extern thread_local int piecewiseAddrBits;
+extern thread_local int piecewisePathBits;
+extern thread_local int piecewiseHistory;
+#define PIECEWISE_MAX_HISTORY 128
+
+// Returns True if the piecewise-linear sizes of the current
+// configuration are in range
+//
+int piecewise_config_valid();
+
+// YAGS: the choice table (log2 entries), the sets of each exception
+// cache (log2), the tag width and the ways of a set (see YagsPredictor)
+extern thread_local int yagsChoiceBits;
+extern thread_local int yagsSetBits;
+extern thread_local int yagsTagBits;
+extern thread_local int yagsWays;
+#define YAGS_MAX_WAYS 16
+
+// Returns True if the YAGS sizes of the current configuration are in
+// range
+//
+int yags_config_valid();
+
+// SIMD kernels of the perceptron and piecewise-linear predictors:
+// scalar, AVX2 or AVX-512, which only piecewise-linear predictors of
+// up to PIECEWISE_TREE_BITS path bits use (AVX2 for the others); -1
+// picks the widest the CPU supports
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+extern int simdKernels;
+
+// Returns True if this CPU can run the SIMD_* kernels 'kernels'
+//
+int simd_kernels_supported(int kernels);
+
+// Non-zero to give the tournament and custom predictors the grouped
+// table layout (see predictors.h)
+extern int groupedTables;
+
+// Conditional branches ahead of the predictor whose table entries
+// simulate_batch prefetches (0 for none; default LOOKAHEAD_DISTANCE)
+#define LOOKAHEAD_DISTANCE 16
+extern int lookaheadDistance;
+
+// Engine running the gshare configurations of a sweep side by side
+// (see simulate_gshare_lanes): off, or lanes stepped one at a time or
+// four to an AVX2 vector; -1 picks the widest the CPU supports on
+// first use
+#define LANES_OFF 0
+#define LANES_SCALAR 1
+#define LANES_AVX2 2
+extern int gshareLanes;
+
+// Most gshare predictors a lane pass runs at once
+#define GSHARE_LANES 32
+
+// Non-zero to count aliasing in the direction tables of the gshare
+// and bi-mode predictors built by init_predictor (see AliasCounter)
+extern int countAliasing;
+
+// Aliasing in a predictor's direction tables: conditional branches,
+// those whose counter was last used by a different branch, and those
+// of them that mispredicted
+typedef struct
+{
+  uint64_t accesses;
+  uint64_t aliased;
+  uint64_t destructive;
+} alias_stats;
+
+// Everything a predictor instance consists of: its configuration and
+// the object built by init_predictor. Saving and loading contexts
+// switches the current predictor between several instances.
+//
+typedef struct
+{
+  int bpType;
+  int ghistoryBitsGshare;
+  int ghistoryBitsTournament;
+  int lhistoryBits;
+  int chooserBitsTournament;
+  int ghistoryBitsCustom;
+  int lhistoryBitsCustom;
+  int chooserBitsCustom;
+  int historyLength;
+  int numPerceptrons;
+  int tageBaseBits;
+  int tageTables;
+  int tageTableBits;
+  int tageTagBits;
+  int tageMaxHistory;
+  int perceptronTables;
+  int perceptronTableBits;
+  int perceptronHistory;
+  int piecewiseAddrBits;
+  int piecewisePathBits;
+  int piecewiseHistory;
+  int yagsChoiceBits;
+  int yagsSetBits;
+  int yagsTagBits;
+  int yagsWays;
+  int choiceBitsBimode;
+  int directionBitsBimode;
+
+  void *instance; // of the predictor class of its type (see predictors.h)
+} predictor_context;
+
+// Copy the current predictor into 'ctx', which takes over its tables
+//
+void save_predictor(predictor_context *ctx);
+
+// Make the predictor saved in 'ctx' the current one
+//
+void load_predictor(const predictor_context *ctx);
+
+// Free the tables of the current predictor
+//
+void free_predictor();
+
+// Snapshot of a predictor: this header, then its counter tables
+// packed four 2-bit counters per byte, its local history registers
+// and its perceptron weights, in the order the predictor lists them
+//
+#define STATE_MAGIC "BPSTATE"
+#define STATE_VERSION 2
+
+typedef struct
+{
+  char magic[8];    // STATE_MAGIC, zero padded
+  uint32_t version; // STATE_VERSION
+  uint32_t bpType;
+  int32_t sizes[5]; // table sizes, perceptron history length and count,
+                    // or the sizes of a tage or perceptron configuration
+  uint32_t reserved;
+  uint64_t ghistory;
+  uint64_t globalHistory;
+} predictor_state_header;
+
+// Write the current predictor to 'stream'
+//
+// Returns True if Successful
+//
+int save_predictor_state(FILE *stream);
+
+// Replace the current predictor by the one saved in 'stream'
+//
+// Returns True if Successful
+//
+int load_predictor_state(FILE *stream);
+
+// Bits of state the current configuration needs: counter tables,
+// history registers and perceptron weights
+//
+uint64_t predictor_storage_bits();
+
+// Store the aliasing counts of the current predictor in '*stats'
+//
+// Returns True if it counts aliasing
+//
+int predictor_alias_stats(alias_stats *stats);
+
+// make_prediction followed by train_predictor for the branch at 'pc'
+// with BR_* 'flags', reading each table entry once. Branches that are
+// not conditional only pass through train_predictor.
+//
+// Returns the prediction (NOTTAKEN for other branches)
+//
+uint32_t predict_and_update(uint32_t pc, uint32_t target, uint8_t flags, uint32_t outcome);
+
+// Run the predictor over a batch of branches in trace order: predict
+// every conditional branch and train on it. Adds the conditional
+// branches and mispredictions to '*num_branches' and '*mispredictions'.
+// Unless NULL, predictions[i] receives the prediction of the i-th
+// conditional branch of the batch.
+//
+void simulate_batch(const trace_batch *batch, uint8_t *predictions, uint32_t *num_branches, uint32_t *mispredictions);
+
+// Same as simulate_batch for each of the gshare predictors
+// contexts[lanes[0, num_lanes)], up to GSHARE_LANES of them, in one
+// pass over the batch. Predictors started together on one trace share
+// their global history, and with it the PC xor history that each
+// lane masks to its own table size; lanes only differ in the counter
+// they step. Adds the mispredictions of contexts[lanes[l]] to
+// mispredictions[lanes[l]].
+//
+void simulate_gshare_lanes(const trace_batch *batch, predictor_context *contexts, const int *lanes, int num_lanes,
+                           uint32_t *num_branches, uint32_t *mispredictions);
+
+// Same as simulate_batch for the conditional branches pcs[0, count)
+// with 'outcomes', on 'threads' threads. The outcomes give every
+// branch's global history, so its table indices are computed up
+// front; each table is split into shards of whole cache lines whose
+// branches are replayed in trace order, one shard per job, and the
+// selector after the tables it chooses between. Predictions and the
+// final tables are exactly those of simulate_batch.
+//
+void simulate_sharded(const uint32_t *pcs, const uint8_t *outcomes, uint32_t count, int threads,
+                      uint8_t *predictions, uint32_t *mispredictions);
 
 #endif
@@ -0,0 +1,1948 @@
+//========================================================//
+//  predictors.h                                          //
+//  Header file for the predictor classes behind the C    //
+//  interface of predictor.h                              //
+//                                                        //
+//  Every predictor owns its tables, so any number of     //
+//  instances can live side by side, and derives from     //
+//  Predictor<> for a simulation loop of its own          //
+//========================================================//
+
+#ifndef PREDICTORS_H
+#define PREDICTORS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "predictor.h"
+#include "trace.h"
+#include "counters.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+// Perceptron training threshold for a history length 'h', and the
+// low PC byte above which the custom predictor breaks ties without
+// the selector
+#define THRESHOLD(h) (1.93 * (h) + 14)
+#define perceptron_threshold 250
+
+// TAGE counter and useful-bit limits, shortest history, bits of path
+// history, and branches between resets of the useful bits
+#define TAGE_CTR_BITS 3
+#define TAGE_CTR_MAX ((1 << (TAGE_CTR_BITS - 1)) - 1)
+#define TAGE_U_BITS 2
+#define TAGE_U_MAX ((1 << TAGE_U_BITS) - 1)
+#define TAGE_USE_ALT_MAX 7
+#define TAGE_MIN_HISTORY 4
+#define TAGE_PATH_BITS 16
+#define TAGE_RESET_PERIOD (1 << 18)
+
+// Limits of the int8 weights and the training threshold counter of
+// PerceptronPredictor
+#define WEIGHT_MAX 127
+#define WEIGHT_MIN -128
+#define THETA_COUNTER_MAX 64
+
+// Training threshold of a piecewise-linear predictor over 'h'
+// branches of history
+#define PIECEWISE_THETA(h) (int)(2.14 * ((h) + 1) + 20.58)
+
+// Most path bits of a piecewise-linear predictor for the AVX-512
+// kernel, which loads every row of a block and reduces them by blends
+#define PIECEWISE_TREE_BITS 4
+#define PIECEWISE_TREE_ROWS (1 << PIECEWISE_TREE_BITS)
+
+// Bytes past the weights that the kernels may read: a 64-byte row
+// load of the last block, which covers the gathers' 4-byte loads too
+#define PIECEWISE_PAD 64
+
+// Smallest tables worth prefetching: those that do not fit in L2
+#define LOOKAHEAD_MIN_BYTES (1 << 20)
+
+//------------------------------------//
+//          Simulation Loop           //
+//------------------------------------//
+
+// Base of every predictor class P, which provides
+//   uint32_t predict(uint32_t pc)
+//   void update(uint32_t pc, uint8_t outcome)
+//   uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+// for conditional branches, the last one returning what predict
+// would have while reading every table entry only once, and
+//   uint64_t global_history()
+//   void prefetch(uint32_t pc, uint64_t history)
+//   uint64_t table_bytes()
+// to fetch the entries a branch at 'pc' will use once the global
+// history is 'history'. simulate is instantiated once per class, so
+// these calls are resolved, and inlined, at compile time.
+//
+template <class P>
+class Predictor
+{
+public:
+  // Same as simulate_batch, for this predictor. The loop runs on a
+  // copy of the predictor, so its history registers and table
+  // pointers stay in registers while the tables are written.
+  //
+  // The outcomes of the whole batch are known, so the global history
+  // ahead of the predictor is too. For tables beyond the caches, the
+  // entries of the branch lookaheadDistance conditional branches
+  // ahead are prefetched while the current one is simulated.
+  //
+  void simulate(const trace_batch *batch, uint8_t *predictions, uint32_t *num_branches, uint32_t *mispredictions)
+  {
+    P p = *static_cast<P *>(this);
+    uint32_t n = 0, miss = 0;
+    if (lookaheadDistance > 0 && p.table_bytes() >= LOOKAHEAD_MIN_BYTES)
+    {
+      run<true>(p, batch, predictions, &n, &miss);
+    }
+    else
+    {
+      run<false>(p, batch, predictions, &n, &miss);
+    }
+    *static_cast<P *>(this) = p;
+    *num_branches += n;
+    *mispredictions += miss;
+  }
+
+private:
+  template <bool LOOKAHEAD>
+  static void run(P &p, const trace_batch *batch, uint8_t *predictions, uint32_t *num_branches, uint32_t *mispredictions)
+  {
+    const uint32_t *pcs = batch->pc;
+    const uint8_t *flags = batch->flags;
+    uint32_t n = 0, miss = 0;
+
+    uint64_t ahead_history = p.global_history();
+    size_t ahead = 0;
+    int distance = 0; // conditional branches in [i, ahead)
+
+    for (size_t i = 0; i < batch->count; i++)
+    {
+      while (LOOKAHEAD && distance < lookaheadDistance && ahead < batch->count)
+      {
+        if (flags[ahead] & BR_CONDITION)
+        {
+          p.prefetch(pcs[ahead], ahead_history);
+          ahead_history = (ahead_history << 1) | (flags[ahead] & BR_OUTCOME);
+          distance++;
+        }
+        ahead++;
+      }
+
+      if (!(flags[i] & BR_CONDITION))
+      {
+        continue;
+      }
+      distance--;
+      uint8_t outcome = flags[i] & BR_OUTCOME;
+      uint32_t prediction = p.predict_and_update(pcs[i], outcome);
+      if (predictions != NULL)
+      {
+        predictions[n] = prediction;
+      }
+      n++;
+      miss += (prediction != outcome);
+    }
+
+    *num_branches = n;
+    *mispredictions = miss;
+  }
+};
+
+// The 2-bit counters (SN to ST) of the predictor tables
+typedef CounterArray<2> Counters;
+
+// log2 of the counters in a cache line, and the largest gap between
+// the gshare and selector sizes that still lets the grouped layout
+// put entries of the same index on one line
+#define LINE_BITS 8
+#define LINE_COUNTERS (1 << LINE_BITS)
+#define GROUP_MAX_GAP (LINE_BITS - 1)
+
+// Where counter i of a table lives in its Counters array: with the
+// grouped layout the low bits of i pick a cache line and the high
+// bits a slot from 'base' on within it. The split layout maps i to
+// itself (low_mask all ones, high_shift 32).
+//
+typedef struct
+{
+  uint32_t low_mask;
+  int low_shift;
+  uint32_t base;
+  int high_shift;
+} slot_map;
+
+static const slot_map split_map = {0xFFFFFFFF, 0, 0, 32};
+
+static inline uint64_t map_slot(const slot_map &m, uint32_t i)
+{
+  return ((uint64_t)(i & m.low_mask) << m.low_shift) + m.base + ((uint64_t)i >> m.high_shift);
+}
+
+//------------------------------------//
+//         Predictor Classes          //
+//------------------------------------//
+
+class StaticPredictor : public Predictor<StaticPredictor>
+{
+public:
+  uint32_t predict(uint32_t /* pc */)
+  {
+    return TAKEN;
+  }
+
+  void update(uint32_t /* pc */, uint8_t /* outcome */)
+  {
+  }
+
+  uint32_t predict_and_update(uint32_t /* pc */, uint8_t /* outcome */)
+  {
+    return TAKEN;
+  }
+
+  uint64_t global_history()
+  {
+    return 0;
+  }
+
+  void prefetch(uint32_t /* pc */, uint64_t /* history */)
+  {
+  }
+
+  uint64_t table_bytes()
+  {
+    return 0;
+  }
+};
+
+// PC of no branch, for entries no branch has used yet
+#define ALIAS_UNUSED 0xffffffff
+
+// Counts aliasing in a table while countAliasing is set: every entry
+// keeps the PC of the last branch that used it
+//
+class AliasCounter
+{
+public:
+  uint32_t *owners; // NULL when not counting
+  alias_stats stats;
+
+  void init(uint64_t entries)
+  {
+    owners = NULL;
+    memset(&stats, 0, sizeof(stats));
+    if (countAliasing)
+    {
+      owners = (uint32_t *)malloc(entries * sizeof(uint32_t));
+      memset(owners, 0xff, entries * sizeof(uint32_t));
+    }
+  }
+
+  void release()
+  {
+    free(owners);
+    owners = NULL;
+  }
+
+  // Count the use of 'entry' by the branch at 'pc'
+  //
+  void note(uint64_t entry, uint32_t pc, int mispredicted)
+  {
+    uint32_t owner = owners[entry];
+    owners[entry] = pc;
+    stats.accesses++;
+    if (owner != pc && owner != ALIAS_UNUSED)
+    {
+      stats.aliased++;
+      stats.destructive += mispredicted;
+    }
+  }
+};
+
+// A table of 2-bit counters indexed by the PC xor the global history
+//
+class GsharePredictor : public Predictor<GsharePredictor>
+{
+public:
+  int bits;
+  uint32_t mask;
+  Counters bht;
+  uint64_t history;
+  AliasCounter aliases;
+
+  void init(int ghistoryBits)
+  {
+    bits = ghistoryBits;
+    mask = (1 << bits) - 1;
+    bht.init(1ULL << bits, WN);
+    history = 0;
+    aliases.init(1ULL << bits);
+  }
+
+  void release()
+  {
+    bht.release();
+    aliases.release();
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    return Counters::taken(bht.get((pc ^ (uint32_t)history) & mask)) ? TAKEN : NOTTAKEN;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    uint32_t index = (pc ^ (uint32_t)history) & mask;
+    uint32_t prediction = Counters::taken(bht.step(index, outcome)) ? TAKEN : NOTTAKEN;
+    history = (history << 1) | outcome;
+    if (aliases.owners != NULL)
+    {
+      aliases.note(index, pc, prediction != outcome);
+    }
+    return prediction;
+  }
+
+  uint64_t global_history()
+  {
+    return history;
+  }
+
+  void prefetch(uint32_t pc, uint64_t future)
+  {
+    bht.prefetch((pc ^ (uint32_t)future) & mask);
+  }
+
+  uint64_t table_bytes()
+  {
+    return Counters::bytes(1ULL << bits);
+  }
+};
+
+// gshare and a PC-indexed local table, with a selector (indexed like
+// gshare) choosing between them. Shared by the tournament and custom
+// predictors. With groupedTables the gshare and selector counters of
+// an index share a cache line, where they are in one Counters array.
+//
+class TournamentTables
+{
+public:
+  int gbits, lbits, cbits;
+  uint32_t gmask, lmask, cmask;
+  Counters bht_gshare;
+  Counters bht_lht;
+  uint64_t *local_history; // updated, but not used for predictions
+  Counters selector;
+  slot_map gshare_map, selector_map;
+  uint64_t ghistory;
+
+  void init(int ghistoryBits, int lhistoryBits, int chooserBits)
+  {
+    gbits = ghistoryBits;
+    lbits = lhistoryBits;
+    cbits = chooserBits;
+    gmask = (1 << gbits) - 1;
+    lmask = (1 << lbits) - 1;
+    cmask = (1 << cbits) - 1;
+
+    if (groupedTables && abs(gbits - cbits) <= GROUP_MAX_GAP)
+    {
+      // Fewest lines (1 << k) that fit both tables' share of a line
+      int k = 0;
+      while ((1ULL << (gbits - k)) + (1ULL << (cbits - k)) > LINE_COUNTERS)
+      {
+        k++;
+      }
+      gshare_map.low_mask = selector_map.low_mask = (1 << k) - 1;
+      gshare_map.low_shift = selector_map.low_shift = LINE_BITS;
+      gshare_map.high_shift = selector_map.high_shift = k;
+      gshare_map.base = 0;
+      selector_map.base = 1 << (gbits - k);
+      bht_gshare.init((uint64_t)LINE_COUNTERS << k, WN);
+      selector = bht_gshare;
+    }
+    else
+    {
+      gshare_map = selector_map = split_map;
+      bht_gshare.init(1ULL << gbits, WN);
+      selector.init(1ULL << cbits, WN);
+    }
+    bht_lht.init(1ULL << lbits, WN);
+    local_history = (uint64_t *)calloc(1 << lbits, sizeof(uint64_t));
+    ghistory = 0;
+  }
+
+  void release()
+  {
+    if (selector.words != bht_gshare.words)
+    {
+      selector.release();
+    }
+    bht_gshare.release();
+    bht_lht.release();
+    free(local_history);
+    local_history = NULL;
+  }
+
+  uint8_t global_prediction(uint32_t pc)
+  {
+    return Counters::taken(bht_gshare.get(map_slot(gshare_map, (pc ^ (uint32_t)ghistory) & gmask))) ? TAKEN : NOTTAKEN;
+  }
+
+  uint8_t local_prediction(uint32_t pc)
+  {
+    return Counters::taken(bht_lht.get(pc & lmask)) ? TAKEN : NOTTAKEN;
+  }
+
+  // Returns True if the selector prefers gshare
+  //
+  int choose_global(uint32_t pc)
+  {
+    return Counters::taken(selector.get(map_slot(selector_map, (pc ^ (uint32_t)ghistory) & cmask)));
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    return choose_global(pc) ? global_prediction(pc) : local_prediction(pc);
+  }
+
+  // Move the selector counter at 'selector_slot' towards whichever
+  // table alone predicted 'outcome'
+  //
+  void train_selector(uint64_t selector_slot, uint8_t gshare_prediction, uint8_t lht_prediction,
+                      uint64_t selector_counter, uint8_t outcome)
+  {
+    if (gshare_prediction != lht_prediction)
+    {
+      selector.set(selector_slot, Counters::next(selector_counter, gshare_prediction == outcome));
+    }
+  }
+
+  // Train the selector, local history and global history on
+  // 'outcome', given the counters the branch read before its gshare
+  // and local counters were stepped and the selector's slot
+  //
+  void train(uint32_t lht_index, uint64_t selector_slot,
+             uint64_t gshare_counter, uint64_t lht_counter, uint64_t selector_counter, uint8_t outcome)
+  {
+    train_selector(selector_slot, Counters::taken(gshare_counter) ? TAKEN : NOTTAKEN,
+                   Counters::taken(lht_counter) ? TAKEN : NOTTAKEN, selector_counter, outcome);
+    local_history[lht_index] = (local_history[lht_index] << 1) | outcome;
+    ghistory = (ghistory << 1) | outcome;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    uint32_t lht_index = pc & lmask;
+    uint64_t selector_slot = map_slot(selector_map, (pc ^ (uint32_t)ghistory) & cmask);
+    uint64_t gshare_counter = bht_gshare.step(map_slot(gshare_map, (pc ^ (uint32_t)ghistory) & gmask), outcome);
+    uint64_t lht_counter = bht_lht.step(lht_index, outcome);
+    uint64_t selector_counter = selector.get(selector_slot);
+
+    uint32_t prediction = Counters::taken(selector_counter) ? Counters::taken(gshare_counter) : Counters::taken(lht_counter);
+    train(lht_index, selector_slot, gshare_counter, lht_counter, selector_counter, outcome);
+    return prediction ? TAKEN : NOTTAKEN;
+  }
+
+  uint64_t global_history()
+  {
+    return ghistory;
+  }
+
+  void prefetch(uint32_t pc, uint64_t history)
+  {
+    bht_gshare.prefetch(map_slot(gshare_map, (pc ^ (uint32_t)history) & gmask));
+    selector.prefetch(map_slot(selector_map, (pc ^ (uint32_t)history) & cmask));
+  }
+
+  uint64_t table_bytes()
+  {
+    return Counters::bytes(1ULL << gbits) + Counters::bytes(1ULL << cbits) + Counters::bytes(1ULL << lbits) +
+           (sizeof(uint64_t) << lbits);
+  }
+};
+
+class TournamentPredictor : public Predictor<TournamentPredictor>, public TournamentTables
+{
+};
+
+// The tournament tables plus a table of perceptrons over the last
+// historyLength outcomes, selected by PC
+//
+class CustomPredictor : public Predictor<CustomPredictor>, public TournamentTables
+{
+public:
+  int historyLength;
+  int numPerceptrons;
+  int *perceptrons; // numPerceptrons rows of bias + historyLength weights
+  uint32_t globalHistory;
+
+  void init(int ghistoryBits, int lhistoryBits, int chooserBits, int length, int count)
+  {
+    TournamentTables::init(ghistoryBits, lhistoryBits, chooserBits);
+    historyLength = length;
+    numPerceptrons = count;
+    perceptrons = (int *)calloc(numPerceptrons * (historyLength + 1), sizeof(int));
+    globalHistory = 0;
+  }
+
+  void release()
+  {
+    TournamentTables::release();
+    free(perceptrons);
+    perceptrons = NULL;
+  }
+
+  int perceptron_output(uint32_t pc)
+  {
+    int *weights = &perceptrons[(pc % numPerceptrons) * (historyLength + 1)];
+    int y = weights[0];
+    for (int i = 0; i < historyLength; i++)
+    {
+      int historyBit = (globalHistory >> i) & 1;
+      y += weights[i + 1] * (historyBit ? 1 : -1);
+    }
+    return y;
+  }
+
+  // The custom prediction from the gshare and local predictions and
+  // the selector counter. Where gshare and the local table disagree,
+  // high PCs predict taken and the rest trust the selector. The
+  // original averaged in the perceptron's prediction as a uint8_t and
+  // tested it for >= 0, which always holds, so that prediction is
+  // passed but not used.
+  //
+  static uint32_t combine(uint32_t pc, uint8_t gshare_prediction, uint8_t lht_prediction,
+                          uint8_t /* perceptron_pred */, uint64_t selector_counter)
+  {
+    if (gshare_prediction != lht_prediction && (pc & 0xFF) > perceptron_threshold)
+    {
+      return TAKEN;
+    }
+    return Counters::taken(selector_counter) ? gshare_prediction : lht_prediction;
+  }
+
+  // Train the perceptron of 'pc', whose output was 'y', on 'outcome'
+  //
+  void train_perceptron(uint32_t pc, int y, uint8_t outcome)
+  {
+    int actual = outcome == TAKEN ? 1 : -1;
+    if ((y >= 0) != (actual == 1) || abs(y) <= THRESHOLD(historyLength))
+    {
+      int *weights = &perceptrons[(pc % numPerceptrons) * (historyLength + 1)];
+      weights[0] += actual;
+      for (int i = 0; i < historyLength; i++)
+      {
+        int historyBit = (globalHistory >> i) & 1;
+        weights[i + 1] += actual * (historyBit ? 1 : -1);
+      }
+    }
+    globalHistory = ((globalHistory << 1) | (outcome == TAKEN ? 1 : 0)) & ((1ULL << historyLength) - 1);
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    uint8_t perceptron_pred = (perceptron_output(pc) >= 0) ? TAKEN : NOTTAKEN;
+    return combine(pc, global_prediction(pc), local_prediction(pc), perceptron_pred,
+                   selector.get(map_slot(selector_map, (pc ^ (uint32_t)ghistory) & cmask)));
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    train_perceptron(pc, perceptron_output(pc), outcome);
+    TournamentTables::update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    uint32_t lht_index = pc & lmask;
+    uint64_t selector_slot = map_slot(selector_map, (pc ^ (uint32_t)ghistory) & cmask);
+    uint64_t gshare_counter = bht_gshare.step(map_slot(gshare_map, (pc ^ (uint32_t)ghistory) & gmask), outcome);
+    uint64_t lht_counter = bht_lht.step(lht_index, outcome);
+    uint64_t selector_counter = selector.get(selector_slot);
+    int y = perceptron_output(pc);
+
+    uint32_t prediction = combine(pc, Counters::taken(gshare_counter) ? TAKEN : NOTTAKEN,
+                                  Counters::taken(lht_counter) ? TAKEN : NOTTAKEN,
+                                  (y >= 0) ? TAKEN : NOTTAKEN, selector_counter);
+    train_perceptron(pc, y, outcome);
+    train(lht_index, selector_slot, gshare_counter, lht_counter, selector_counter, outcome);
+    return prediction;
+  }
+
+  // The perceptrons are few enough to stay cached, so only the
+  // tournament tables are prefetched
+  //
+  uint64_t table_bytes()
+  {
+    return TournamentTables::table_bytes() + (uint64_t)numPerceptrons * (historyLength + 1) * sizeof(int);
+  }
+};
+
+// A TAGE tagged entry: prediction counter, taken when >= 0; useful bits,
+// set while the entry predicts better than the next longest match;
+// and the partial tag
+typedef struct
+{
+  int8_t ctr;
+  uint8_t u;
+  uint16_t tag;
+} tage_entry;
+
+// A history of 'length' bits folded (xored) down to 'olength' bits,
+// updated in a few operations per branch rather than refolded. The
+// bit leaving the history sits at 'outpoint' in the folded value.
+//
+typedef struct
+{
+  uint32_t comp;
+  int length;
+  int olength;
+  int outpoint;
+} folded_history;
+
+// Everything of a TAGE predictor that changes as it runs, except its
+// tables, in one block so that states save and restore as a whole.
+// history[ptr] is the latest outcome and history[ptr + i] the one i
+// branches earlier.
+typedef struct
+{
+  uint8_t history[TAGE_HISTORY_BUFFER];
+  int ptr;
+  uint32_t path;          // low PC bit of the last TAGE_PATH_BITS branches
+  int use_alt_on_na;      // >= 0 trusts the alternate over new entries
+  uint32_t tick;          // branches since the useful bits were reset
+  int reset_msb;          // which useful bit the next reset clears
+  uint32_t seed;          // of the allocation choices
+  folded_history index_fold[TAGE_MAX_TABLES];
+  folded_history tag_fold[2][TAGE_MAX_TABLES];
+} tage_registers;
+
+// What a branch finds in the tables: its index and tag in each, the
+// longest ('provider') and next longest ('alt') matching tables, -1
+// when none, and their predictions
+typedef struct
+{
+  uint32_t base_index;
+  uint32_t index[TAGE_MAX_TABLES];
+  uint16_t tag[TAGE_MAX_TABLES];
+  int provider, alt;
+  uint8_t provider_pred, alt_pred, prediction;
+  int weak_new; // the provider is new and undecided
+} tage_lookup;
+
+// The TAGE predictor: a bimodal base table and tageTables tables of
+// tagged counters, indexed by hashes of the PC and of geometrically
+// longer global histories. The longest table whose tag matches
+// provides the prediction; a mispredicted branch allocates an entry
+// in a longer table whose useful bits are clear.
+//
+class TagePredictor : public Predictor<TagePredictor>
+{
+public:
+  int num_tables;
+  int base_bits, table_bits, tag_bits;
+  uint32_t base_mask, table_mask, tag_mask;
+  int lengths[TAGE_MAX_TABLES];
+  Counters base;
+  tage_entry *tables; // num_tables tables of (1 << table_bits) entries
+  tage_registers *regs;
+
+  void init(int baseBits, int numTables, int tableBits, int tagBits, int maxHistory)
+  {
+    num_tables = numTables;
+    base_bits = baseBits;
+    table_bits = tableBits;
+    tag_bits = tagBits;
+    base_mask = (1 << base_bits) - 1;
+    table_mask = (1 << table_bits) - 1;
+    tag_mask = (1 << tag_bits) - 1;
+    base.init(1ULL << base_bits, WN);
+    tables = (tage_entry *)calloc((size_t)num_tables << table_bits, sizeof(tage_entry));
+    regs = (tage_registers *)calloc(1, sizeof(tage_registers));
+    regs->seed = 1;
+
+    // History lengths from TAGE_MIN_HISTORY to maxHistory in a
+    // geometric series
+    for (int i = 0; i < num_tables; i++)
+    {
+      double ratio = (num_tables > 1) ? (double)i / (num_tables - 1) : 0;
+      lengths[i] = (int)(TAGE_MIN_HISTORY * pow((double)maxHistory / TAGE_MIN_HISTORY, ratio) + 0.5);
+      init_fold(&regs->index_fold[i], lengths[i], table_bits);
+      init_fold(&regs->tag_fold[0][i], lengths[i], tag_bits);
+      init_fold(&regs->tag_fold[1][i], lengths[i], tag_bits - 1);
+    }
+  }
+
+  void release()
+  {
+    base.release();
+    free(tables);
+    free(regs);
+    tables = NULL;
+    regs = NULL;
+  }
+
+  // Returns True if the registers, as read back from a saved state,
+  // are ones this configuration can reach: the folds keep the lengths
+  // init gave them and every value is in range
+  //
+  int registers_valid()
+  {
+    if (regs->ptr < 0 || regs->ptr >= TAGE_HISTORY_BUFFER || regs->path >= (1U << TAGE_PATH_BITS) ||
+        regs->use_alt_on_na < -TAGE_USE_ALT_MAX - 1 || regs->use_alt_on_na > TAGE_USE_ALT_MAX ||
+        regs->tick >= TAGE_RESET_PERIOD || (regs->reset_msb != 0 && regs->reset_msb != 1) || regs->seed == 0)
+    {
+      return 0;
+    }
+    for (int i = 0; i < TAGE_HISTORY_BUFFER; i++)
+    {
+      if (regs->history[i] > 1)
+      {
+        return 0;
+      }
+    }
+    for (int i = 0; i < num_tables; i++)
+    {
+      const folded_history *folds[3] = {&regs->index_fold[i], &regs->tag_fold[0][i], &regs->tag_fold[1][i]};
+      const int olengths[3] = {table_bits, tag_bits, tag_bits - 1};
+      for (int f = 0; f < 3; f++)
+      {
+        if (folds[f]->length != lengths[i] || folds[f]->olength != olengths[f] ||
+            folds[f]->outpoint != lengths[i] % olengths[f] || folds[f]->comp >= (1U << olengths[f]))
+        {
+          return 0;
+        }
+      }
+    }
+    return 1;
+  }
+
+  static void init_fold(folded_history *f, int length, int olength)
+  {
+    f->comp = 0;
+    f->length = length;
+    f->olength = olength;
+    f->outpoint = length % olength;
+  }
+
+  // Shift the latest outcome 'in' into 'f' and the one 'length'
+  // branches earlier, 'out', out of it
+  //
+  static void update_fold(folded_history *f, uint32_t in, uint32_t out)
+  {
+    uint32_t comp = (f->comp << 1) ^ in ^ (out << f->outpoint);
+    comp ^= comp >> f->olength;
+    f->comp = comp & ((1U << f->olength) - 1);
+  }
+
+  tage_entry *entry(int table, uint32_t index)
+  {
+    return &tables[((size_t)table << table_bits) + index];
+  }
+
+  void lookup(uint32_t pc, tage_lookup *l)
+  {
+    l->base_index = pc & base_mask;
+    for (int i = 0; i < num_tables; i++)
+    {
+      int path_bits = (lengths[i] < TAGE_PATH_BITS) ? lengths[i] : TAGE_PATH_BITS;
+      uint32_t path = regs->path & ((1U << path_bits) - 1);
+      l->index[i] = (pc ^ (pc >> (abs(table_bits - i) + 1)) ^ regs->index_fold[i].comp ^ path ^ (path >> table_bits)) &
+                    table_mask;
+      l->tag[i] = (pc ^ regs->tag_fold[0][i].comp ^ (regs->tag_fold[1][i].comp << 1)) & tag_mask;
+    }
+
+    l->provider = l->alt = -1;
+    for (int i = num_tables - 1; i >= 0; i--)
+    {
+      if (entry(i, l->index[i])->tag == l->tag[i])
+      {
+        if (l->provider < 0)
+        {
+          l->provider = i;
+        }
+        else
+        {
+          l->alt = i;
+          break;
+        }
+      }
+    }
+
+    uint8_t base_pred = Counters::taken(base.get(l->base_index)) ? TAKEN : NOTTAKEN;
+    l->alt_pred = (l->alt >= 0) ? (entry(l->alt, l->index[l->alt])->ctr >= 0) : base_pred;
+    l->weak_new = 0;
+    if (l->provider < 0)
+    {
+      l->provider_pred = l->prediction = base_pred;
+      return;
+    }
+    tage_entry *e = entry(l->provider, l->index[l->provider]);
+    l->provider_pred = (e->ctr >= 0) ? TAKEN : NOTTAKEN;
+    l->weak_new = (e->ctr == 0 || e->ctr == -1) && e->u == 0;
+    l->prediction = (l->weak_new && regs->use_alt_on_na >= 0) ? l->alt_pred : l->provider_pred;
+  }
+
+  static void step_ctr(int8_t *ctr, uint8_t outcome)
+  {
+    if (outcome && *ctr < TAGE_CTR_MAX)
+    {
+      (*ctr)++;
+    }
+    else if (!outcome && *ctr > -TAGE_CTR_MAX - 1)
+    {
+      (*ctr)--;
+    }
+  }
+
+  // Next of the allocation choices, from a 32-bit xorshift
+  //
+  uint32_t random()
+  {
+    uint32_t x = regs->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    regs->seed = x;
+    return x;
+  }
+
+  void train(uint32_t pc, const tage_lookup *l, uint8_t outcome)
+  {
+    // Learn whether new entries predict better than the alternate
+    if (l->weak_new && l->provider_pred != l->alt_pred)
+    {
+      if (l->alt_pred == outcome && regs->use_alt_on_na < TAGE_USE_ALT_MAX)
+      {
+        regs->use_alt_on_na++;
+      }
+      else if (l->alt_pred != outcome && regs->use_alt_on_na > -TAGE_USE_ALT_MAX - 1)
+      {
+        regs->use_alt_on_na--;
+      }
+    }
+
+    // Allocate on a misprediction of the longest match: in one of the
+    // first two longer tables with a free entry, else age them all
+    if (l->provider_pred != outcome && l->provider < num_tables - 1)
+    {
+      int first = l->provider + 1;
+      if (first < num_tables - 1 && (random() & 1))
+      {
+        first++;
+      }
+      int allocated = 0;
+      for (int i = first; i < num_tables && !allocated; i++)
+      {
+        tage_entry *e = entry(i, l->index[i]);
+        if (e->u == 0)
+        {
+          e->tag = l->tag[i];
+          e->ctr = outcome ? 0 : -1;
+          allocated = 1;
+        }
+      }
+      for (int i = l->provider + 1; i < num_tables && !allocated; i++)
+      {
+        tage_entry *e = entry(i, l->index[i]);
+        if (e->u > 0)
+        {
+          e->u--;
+        }
+      }
+    }
+
+    // Train the provider, and the alternate too while the provider is
+    // not known to be useful
+    if (l->provider >= 0)
+    {
+      tage_entry *e = entry(l->provider, l->index[l->provider]);
+      if (e->u == 0)
+      {
+        if (l->alt >= 0)
+        {
+          step_ctr(&entry(l->alt, l->index[l->alt])->ctr, outcome);
+        }
+        else
+        {
+          base.step(l->base_index, outcome);
+        }
+      }
+      step_ctr(&e->ctr, outcome);
+      if (l->provider_pred != l->alt_pred)
+      {
+        if (l->provider_pred == outcome && e->u < TAGE_U_MAX)
+        {
+          e->u++;
+        }
+        else if (l->provider_pred != outcome && e->u > 0)
+        {
+          e->u--;
+        }
+      }
+    }
+    else
+    {
+      base.step(l->base_index, outcome);
+    }
+
+    // Clear one of the useful bits of every entry, alternately, every
+    // TAGE_RESET_PERIOD branches so stale entries can be replaced
+    if (++regs->tick == TAGE_RESET_PERIOD)
+    {
+      regs->tick = 0;
+      uint8_t keep = regs->reset_msb ? 1 : 2;
+      for (size_t i = 0; i < ((size_t)num_tables << table_bits); i++)
+      {
+        tables[i].u &= keep;
+      }
+      regs->reset_msb = !regs->reset_msb;
+    }
+
+    // Shift the outcome into the histories
+    int ptr = (regs->ptr - 1) & (TAGE_HISTORY_BUFFER - 1);
+    regs->ptr = ptr;
+    regs->history[ptr] = outcome;
+    regs->path = ((regs->path << 1) | (pc & 1)) & ((1U << TAGE_PATH_BITS) - 1);
+    for (int i = 0; i < num_tables; i++)
+    {
+      uint32_t out = regs->history[(ptr + lengths[i]) & (TAGE_HISTORY_BUFFER - 1)];
+      update_fold(&regs->index_fold[i], outcome, out);
+      update_fold(&regs->tag_fold[0][i], outcome, out);
+      update_fold(&regs->tag_fold[1][i], outcome, out);
+    }
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    tage_lookup l;
+    lookup(pc, &l);
+    return l.prediction;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    tage_lookup l;
+    lookup(pc, &l);
+    train(pc, &l, outcome);
+    return l.prediction;
+  }
+
+  // The tagged tables hash folded histories that are only known once
+  // the branches before have been simulated, so only the base entry,
+  // indexed by the PC alone, is prefetched
+  //
+  uint64_t global_history()
+  {
+    return 0;
+  }
+
+  void prefetch(uint32_t pc, uint64_t /* history */)
+  {
+    base.prefetch(pc & base_mask);
+  }
+
+  uint64_t table_bytes()
+  {
+    return Counters::bytes(1ULL << base_bits) + (sizeof(tage_entry) << table_bits) * num_tables;
+  }
+};
+
+// Everything of a hashed perceptron that changes as it runs, except
+// its weights. folds[j] is the global history of the last bounds[j]
+// branches folded to the table index width; history is laid out as
+// in tage_registers, with room for 32-bit gathers past its end.
+typedef struct
+{
+  uint8_t history[PERCEPTRON_HISTORY_BUFFER + 4];
+  int ptr;
+  int theta;   // training threshold
+  int counter; // of mispredictions against low-confidence trainings
+  uint32_t folds[PERCEPTRON_MAX_TABLES + 8];
+} perceptron_registers;
+
+// A hashed perceptron: numTables tables of int8 weights. Table 0 is
+// indexed by the PC alone and table i by the PC xor the global history
+// bits [bounds[i], bounds[i + 1]) folded to the index width; the
+// segments grow geometrically up to historyLength bits. The weights
+// of a branch sum to its prediction, and are trained towards the
+// outcome on a misprediction or a sum within the threshold, which
+// adapts to keep those two cases balanced.
+//
+// A segment's fold is the xor of the folds of its two bounds, so each
+// branch updates numTables + 1 folded registers whatever the history
+// length. With AVX2 the indices, weights, sum, update and folds are
+// done eight tables to a vector.
+//
+class PerceptronPredictor : public Predictor<PerceptronPredictor>
+{
+public:
+  int num_tables, table_bits, history_length;
+  uint32_t table_mask;
+  int use_avx2;
+  int32_t bounds[PERCEPTRON_MAX_TABLES + 8]; // 0 past bounds[num_tables]
+  int32_t outpoints[PERCEPTRON_MAX_TABLES + 8];
+  int32_t offsets[PERCEPTRON_MAX_TABLES];    // of each table in weights
+  int32_t valid[PERCEPTRON_MAX_TABLES];      // -1 for tables in use
+  int8_t *weights;
+  perceptron_registers *regs;
+
+  void init(int numTables, int tableBits, int historyLength, int avx2)
+  {
+    num_tables = numTables;
+    table_bits = tableBits;
+    history_length = historyLength;
+    table_mask = (1 << table_bits) - 1;
+    use_avx2 = avx2;
+
+    // Each segment is at least a bit longer than the one before
+    memset(bounds, 0, sizeof(bounds));
+    memset(outpoints, 0, sizeof(outpoints));
+    for (int i = 2; i <= num_tables; i++)
+    {
+      double geometric = pow((double)history_length, (double)(i - 1) / (num_tables - 1));
+      bounds[i] = (int)(geometric + 0.5);
+      if (bounds[i] <= bounds[i - 1])
+      {
+        bounds[i] = bounds[i - 1] + 1;
+      }
+    }
+    bounds[num_tables] = history_length;
+    for (int j = 0; j <= num_tables; j++)
+    {
+      outpoints[j] = bounds[j] % table_bits;
+    }
+    for (int i = 0; i < PERCEPTRON_MAX_TABLES; i++)
+    {
+      offsets[i] = (i < num_tables) ? i << table_bits : 0;
+      valid[i] = (i < num_tables) ? -1 : 0;
+    }
+
+    weights = (int8_t *)calloc(((size_t)num_tables << table_bits) + 4, 1);
+    regs = (perceptron_registers *)calloc(1, sizeof(perceptron_registers));
+    regs->theta = (int)(2.14 * (num_tables + 1) + 20.58);
+  }
+
+  void release()
+  {
+    free(weights);
+    free(regs);
+    weights = NULL;
+    regs = NULL;
+  }
+
+  // Returns True if the registers, as read back from a saved state,
+  // are in range: outcomes of 0 or 1, folds within the index width
+  // and zero past the last bound, and a threshold counter that has
+  // not overflowed
+  //
+  int registers_valid()
+  {
+    if (regs->ptr < 0 || regs->ptr >= PERCEPTRON_HISTORY_BUFFER || regs->theta < 0 ||
+        regs->counter <= -THETA_COUNTER_MAX || regs->counter >= THETA_COUNTER_MAX)
+    {
+      return 0;
+    }
+    for (int i = 0; i < PERCEPTRON_HISTORY_BUFFER + 4; i++)
+    {
+      if (regs->history[i] > 1)
+      {
+        return 0;
+      }
+    }
+    for (int j = 0; j < PERCEPTRON_MAX_TABLES + 8; j++)
+    {
+      if (regs->folds[j] > ((j <= num_tables) ? table_mask : 0))
+      {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  // Train the threshold on a prediction with weight sum 'sum'
+  //
+  // Returns True if the weights should be trained
+  //
+  int train_theta(int sum, uint8_t prediction, uint8_t outcome)
+  {
+    if (prediction != outcome)
+    {
+      if (++regs->counter >= THETA_COUNTER_MAX)
+      {
+        regs->theta++;
+        regs->counter = 0;
+      }
+      return 1;
+    }
+    if (abs(sum) <= regs->theta)
+    {
+      if (--regs->counter <= -THETA_COUNTER_MAX)
+      {
+        regs->theta--;
+        regs->counter = 0;
+      }
+      return 1;
+    }
+    return 0;
+  }
+
+  uint32_t index(uint32_t pc, int i)
+  {
+    return (((pc ^ (pc >> table_bits)) ^ regs->folds[i + 1] ^ regs->folds[i]) & table_mask) + offsets[i];
+  }
+
+  int sum_scalar(uint32_t pc)
+  {
+    int sum = 0;
+    for (int i = 0; i < num_tables; i++)
+    {
+      sum += weights[index(pc, i)];
+    }
+    return sum;
+  }
+
+  // Shift 'outcome' into the history and the folds
+  //
+  void push_scalar(uint8_t outcome)
+  {
+    int ptr = (regs->ptr - 1) & (PERCEPTRON_HISTORY_BUFFER - 1);
+    regs->ptr = ptr;
+    regs->history[ptr] = outcome;
+    for (int j = 0; j <= num_tables; j++)
+    {
+      uint32_t out = regs->history[(ptr + bounds[j]) & (PERCEPTRON_HISTORY_BUFFER - 1)];
+      uint32_t comp = (regs->folds[j] << 1) ^ outcome ^ (out << outpoints[j]);
+      comp ^= comp >> table_bits;
+      regs->folds[j] = comp & table_mask;
+    }
+  }
+
+  uint32_t predict_and_update_scalar(uint32_t pc, uint8_t outcome)
+  {
+    int sum = sum_scalar(pc);
+    uint8_t prediction = (sum >= 0) ? TAKEN : NOTTAKEN;
+    if (train_theta(sum, prediction, outcome))
+    {
+      for (int i = 0; i < num_tables; i++)
+      {
+        int8_t *w = &weights[index(pc, i)];
+        if (outcome && *w < WEIGHT_MAX)
+        {
+          (*w)++;
+        }
+        else if (!outcome && *w > WEIGHT_MIN)
+        {
+          (*w)--;
+        }
+      }
+    }
+    push_scalar(outcome);
+    return prediction;
+  }
+
+#ifdef __SSE2__
+  __attribute__((target("avx2"))) uint32_t predict_and_update_avx2(uint32_t pc, uint8_t outcome)
+  {
+    const int vectors = (num_tables + 7) / 8;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(table_mask);
+    const __m256i hash = _mm256_set1_epi32(pc ^ (pc >> table_bits));
+
+    // Gather and sign-extend the weights of eight tables at a time
+    __m256i indices[PERCEPTRON_MAX_TABLES / 8], values[PERCEPTRON_MAX_TABLES / 8];
+    __m256i total = zero;
+    for (int v = 0; v < vectors; v++)
+    {
+      __m256i segment = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&regs->folds[8 * v + 1]),
+                                         _mm256_loadu_si256((const __m256i *)&regs->folds[8 * v]));
+      indices[v] = _mm256_add_epi32(_mm256_and_si256(_mm256_xor_si256(hash, segment), mask),
+                                    _mm256_loadu_si256((const __m256i *)&offsets[8 * v]));
+      __m256i words = _mm256_mask_i32gather_epi32(zero, (const int *)weights, indices[v],
+                                                  _mm256_loadu_si256((const __m256i *)&valid[8 * v]), 1);
+      values[v] = _mm256_srai_epi32(_mm256_slli_epi32(words, 24), 24);
+      total = _mm256_add_epi32(total, values[v]);
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int sum = _mm_cvtsi128_si32(half);
+
+    uint8_t prediction = (sum >= 0) ? TAKEN : NOTTAKEN;
+    if (train_theta(sum, prediction, outcome))
+    {
+      // Saturating step of every weight, stored back a byte at a time
+      const __m256i step = _mm256_set1_epi32(outcome ? 1 : -1);
+      const __m256i high = _mm256_set1_epi32(WEIGHT_MAX);
+      const __m256i low = _mm256_set1_epi32(WEIGHT_MIN);
+      for (int v = 0; v < vectors; v++)
+      {
+        int32_t index[8], value[8];
+        __m256i trained = _mm256_max_epi32(_mm256_min_epi32(_mm256_add_epi32(values[v], step), high), low);
+        _mm256_storeu_si256((__m256i *)index, indices[v]);
+        _mm256_storeu_si256((__m256i *)value, trained);
+        for (int l = 0; l < 8 && 8 * v + l < num_tables; l++)
+        {
+          weights[index[l]] = (int8_t)value[l];
+        }
+      }
+    }
+
+    // Shift the outcome into the history and all the folds
+    int ptr = (regs->ptr - 1) & (PERCEPTRON_HISTORY_BUFFER - 1);
+    regs->ptr = ptr;
+    regs->history[ptr] = outcome;
+    const __m256i in = _mm256_set1_epi32(outcome);
+    const __m256i position = _mm256_set1_epi32(ptr);
+    const __m256i wrap = _mm256_set1_epi32(PERCEPTRON_HISTORY_BUFFER - 1);
+    const __m128i width = _mm_cvtsi32_si128(table_bits);
+    for (int v = 0; v < (num_tables + 8) / 8; v++)
+    {
+      __m256i at = _mm256_and_si256(_mm256_add_epi32(position, _mm256_loadu_si256((const __m256i *)&bounds[8 * v])), wrap);
+      __m256i out = _mm256_and_si256(_mm256_i32gather_epi32((const int *)regs->history, at, 1), _mm256_set1_epi32(1));
+      __m256i comp = _mm256_loadu_si256((const __m256i *)&regs->folds[8 * v]);
+      comp = _mm256_xor_si256(_mm256_xor_si256(_mm256_slli_epi32(comp, 1), in),
+                              _mm256_sllv_epi32(out, _mm256_loadu_si256((const __m256i *)&outpoints[8 * v])));
+      comp = _mm256_xor_si256(comp, _mm256_srl_epi32(comp, width));
+      _mm256_storeu_si256((__m256i *)&regs->folds[8 * v], _mm256_and_si256(comp, mask));
+    }
+    return prediction;
+  }
+#endif
+
+  uint32_t predict(uint32_t pc)
+  {
+    return (sum_scalar(pc) >= 0) ? TAKEN : NOTTAKEN;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+#ifdef __SSE2__
+    if (use_avx2)
+    {
+      return predict_and_update_avx2(pc, outcome);
+    }
+#endif
+    return predict_and_update_scalar(pc, outcome);
+  }
+
+  // The indices hash folded histories, so only the bias weight, indexed
+  // by the PC alone, is prefetched
+  //
+  uint64_t global_history()
+  {
+    return 0;
+  }
+
+  void prefetch(uint32_t pc, uint64_t /* history */)
+  {
+    __builtin_prefetch(&weights[(pc ^ (pc >> table_bits)) & table_mask], 1);
+  }
+
+  uint64_t table_bytes()
+  {
+    return (uint64_t)num_tables << table_bits;
+  }
+};
+
+// Everything of a piecewise-linear predictor that changes as it runs,
+// except its weights: the outcomes and path indices of the last
+// history_length branches, each written twice, at slot and slot +
+// history_length, so that the window [ptr, ptr + history_length) holds
+// them newest first without wrapping
+typedef struct
+{
+  int32_t history[2 * PIECEWISE_MAX_HISTORY + 8];
+  int32_t path[2 * PIECEWISE_MAX_HISTORY + 8];
+  int ptr;
+} piecewise_registers;
+
+// The piecewise-linear predictor: a bias weight per branch address,
+// and a weight for every (address, position i, path address) with
+// the path address that of the branch i before. The prediction is
+// the bias plus each weight times +-1 for the outcome at its position,
+// so a branch learns a separate linear function for every path that
+// leads to it. Weights are trained on a misprediction or a sum within
+// PIECEWISE_THETA.
+//
+// The int8 weights of an address form one block ordered by path
+// address then position, so a branch only touches that block. With
+// AVX2 the sum and the update gather eight positions to a vector.
+// AVX-512 needs no gathers when there are at most 16 path addresses:
+// the window is also kept newest first as bit masks, one of outcomes
+// and one for each bit of the path addresses. Every row of the block
+// is loaded and a tree of byte blends on those masks picks the weight
+// of each position, so all the weights of the branch sit in one or two
+// vectors, which are summed, trained and stored back under masks.
+//
+class PiecewisePredictor : public Predictor<PiecewisePredictor>
+{
+public:
+  int addr_bits, path_bits, history_length;
+  uint32_t addr_mask, path_mask;
+  int theta;
+  int use_avx2, use_avx512;
+  int32_t positions[PIECEWISE_MAX_HISTORY]; // 0, 1, 2... of the AVX2 indices
+  int32_t valid[PIECEWISE_MAX_HISTORY];     // -1 for positions in use
+  uint64_t window_valid[PIECEWISE_MAX_HISTORY / 64]; // positions in use
+  uint64_t taken_window[PIECEWISE_MAX_HISTORY / 64]; // newest first, for AVX-512
+  uint64_t path_window[PIECEWISE_TREE_BITS][PIECEWISE_MAX_HISTORY / 64]; // a mask per path bit
+  int8_t *bias;    // 1 << addr_bits weights
+  int8_t *weights; // 1 << addr_bits blocks, following the biases
+  piecewise_registers *regs;
+
+  void init(int addrBits, int pathBits, int historyLength, int kernels)
+  {
+    addr_bits = addrBits;
+    path_bits = pathBits;
+    history_length = historyLength;
+    addr_mask = (1 << addr_bits) - 1;
+    path_mask = (1 << path_bits) - 1;
+    theta = PIECEWISE_THETA(history_length);
+    use_avx2 = (kernels >= SIMD_AVX2);
+    use_avx512 = (kernels == SIMD_AVX512 && path_bits <= PIECEWISE_TREE_BITS);
+    for (int i = 0; i < PIECEWISE_MAX_HISTORY; i++)
+    {
+      positions[i] = i;
+      valid[i] = (i < history_length) ? -1 : 0;
+    }
+    for (int c = 0; c < PIECEWISE_MAX_HISTORY / 64; c++)
+    {
+      int in_use = history_length - 64 * c;
+      window_valid[c] = (in_use >= 64) ? ~0ULL : (in_use > 0) ? (1ULL << in_use) - 1 : 0;
+    }
+    bias = (int8_t *)calloc(weight_count() + PIECEWISE_PAD, 1);
+    weights = bias + (1 << addr_bits);
+    regs = (piecewise_registers *)calloc(1, sizeof(piecewise_registers));
+    load_window();
+  }
+
+  void release()
+  {
+    free(bias);
+    free(regs);
+    bias = weights = NULL;
+    regs = NULL;
+  }
+
+  // Returns True if the registers, as read back from a saved state,
+  // have the window inside the history and outcomes of 0 or 1; path
+  // addresses are masked to path_bits, since they index the blocks
+  //
+  int registers_valid()
+  {
+    if (regs->ptr < 0 || regs->ptr >= history_length)
+    {
+      return 0;
+    }
+    for (int i = 0; i < 2 * PIECEWISE_MAX_HISTORY + 8; i++)
+    {
+      if (regs->history[i] != 0 && regs->history[i] != 1)
+      {
+        return 0;
+      }
+      regs->path[i] &= path_mask;
+    }
+    return 1;
+  }
+
+  // Copy the window of the registers to the bit masks, after init or
+  // after the registers were read back from a saved state
+  //
+  void load_window()
+  {
+    for (int c = 0; c < PIECEWISE_MAX_HISTORY / 64; c++)
+    {
+      taken_window[c] = 0;
+      for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+      {
+        path_window[b][c] = 0;
+      }
+    }
+    for (int i = 0; i < history_length; i++)
+    {
+      uint64_t position = 1ULL << (i % 64);
+      if (regs->history[regs->ptr + i])
+      {
+        taken_window[i / 64] |= position;
+      }
+      for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+      {
+        if ((regs->path[regs->ptr + i] >> b) & 1)
+        {
+          path_window[b][i / 64] |= position;
+        }
+      }
+    }
+  }
+
+  // Returns the number of weights, biases included
+  //
+  uint64_t weight_count()
+  {
+    return ((uint64_t)1 << addr_bits) * (1 + ((uint64_t)history_length << path_bits));
+  }
+
+  static void train_weight(int8_t *w, int agree)
+  {
+    if (agree && *w < WEIGHT_MAX)
+    {
+      (*w)++;
+    }
+    else if (!agree && *w > WEIGHT_MIN)
+    {
+      (*w)--;
+    }
+  }
+
+  // Shift the branch at 'pc' and its outcome into the window
+  //
+  void push(uint32_t pc, uint8_t outcome)
+  {
+    int ptr = (regs->ptr > 0) ? regs->ptr - 1 : history_length - 1;
+    regs->ptr = ptr;
+    regs->history[ptr] = regs->history[ptr + history_length] = outcome;
+    regs->path[ptr] = regs->path[ptr + history_length] = pc & path_mask;
+  }
+
+  int sum_scalar(uint32_t pc)
+  {
+    const int8_t *block = &weights[(size_t)(pc & addr_mask) * history_length << path_bits];
+    const int32_t *history = &regs->history[regs->ptr];
+    const int32_t *path = &regs->path[regs->ptr];
+    int sum = bias[pc & addr_mask];
+    for (int i = 0; i < history_length; i++)
+    {
+      int w = block[path[i] * history_length + i];
+      sum += history[i] ? w : -w;
+    }
+    return sum;
+  }
+
+  uint32_t predict_and_update_scalar(uint32_t pc, uint8_t outcome)
+  {
+    int sum = sum_scalar(pc);
+    uint8_t prediction = (sum >= 0) ? TAKEN : NOTTAKEN;
+    if (prediction != outcome || abs(sum) <= theta)
+    {
+      int8_t *block = &weights[(size_t)(pc & addr_mask) * history_length << path_bits];
+      const int32_t *history = &regs->history[regs->ptr];
+      const int32_t *path = &regs->path[regs->ptr];
+      train_weight(&bias[pc & addr_mask], outcome);
+      for (int i = 0; i < history_length; i++)
+      {
+        train_weight(&block[path[i] * history_length + i], history[i] == outcome);
+      }
+    }
+    push(pc, outcome);
+    return prediction;
+  }
+
+#ifdef __SSE2__
+  __attribute__((target("avx2"))) uint32_t predict_and_update_avx2(uint32_t pc, uint8_t outcome)
+  {
+    const int vectors = (history_length + 7) / 8;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i block = _mm256_set1_epi32((int)((pc & addr_mask) * history_length << path_bits));
+    const __m256i row = _mm256_set1_epi32(history_length);
+    const int32_t *history = &regs->history[regs->ptr];
+    const int32_t *path = &regs->path[regs->ptr];
+
+    // Gather and sign-extend the weights of eight positions at a
+    // time, negating those whose outcome was not taken
+    __m256i indices[PIECEWISE_MAX_HISTORY / 8], values[PIECEWISE_MAX_HISTORY / 8];
+    __m256i total = zero;
+    for (int v = 0; v < vectors; v++)
+    {
+      indices[v] = _mm256_add_epi32(_mm256_add_epi32(block, _mm256_loadu_si256((const __m256i *)&positions[8 * v])),
+                                    _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)&path[8 * v]), row));
+      __m256i words = _mm256_mask_i32gather_epi32(zero, (const int *)weights, indices[v],
+                                                  _mm256_loadu_si256((const __m256i *)&valid[8 * v]), 1);
+      values[v] = _mm256_srai_epi32(_mm256_slli_epi32(words, 24), 24);
+      __m256i negate = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)&history[8 * v]), one);
+      total = _mm256_add_epi32(total, _mm256_sub_epi32(_mm256_xor_si256(values[v], negate), negate));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int sum = bias[pc & addr_mask] + _mm_cvtsi128_si32(half);
+
+    uint8_t prediction = (sum >= 0) ? TAKEN : NOTTAKEN;
+    if (prediction != outcome || abs(sum) <= theta)
+    {
+      // +1 where the outcome at a position agrees with this one, -1
+      // elsewhere, saturating and stored back a byte at a time
+      const __m256i taken = _mm256_set1_epi32(outcome);
+      const __m256i high = _mm256_set1_epi32(WEIGHT_MAX);
+      const __m256i low = _mm256_set1_epi32(WEIGHT_MIN);
+      // Locals, as the byte stores could otherwise alias the members
+      int8_t *w = weights;
+      int remaining = history_length;
+      train_weight(&bias[pc & addr_mask], outcome);
+      for (int v = 0; v < vectors; v++, remaining -= 8)
+      {
+        int32_t index[8], value[8];
+        __m256i disagree = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&history[8 * v]), taken);
+        __m256i step = _mm256_sub_epi32(one, _mm256_slli_epi32(disagree, 1));
+        __m256i trained = _mm256_max_epi32(_mm256_min_epi32(_mm256_add_epi32(values[v], step), high), low);
+        _mm256_storeu_si256((__m256i *)index, indices[v]);
+        _mm256_storeu_si256((__m256i *)value, trained);
+        for (int l = 0; l < 8 && l < remaining; l++)
+        {
+          w[index[l]] = (int8_t)value[l];
+        }
+      }
+    }
+    push(pc, outcome);
+    return prediction;
+  }
+
+  // Returns the mask of the positions whose path address is 'r'
+  //
+  uint64_t row_mask(int r, int c)
+  {
+    uint64_t here = window_valid[c];
+    for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+    {
+      here &= ((r >> b) & 1) ? path_window[b][c] : ~path_window[b][c];
+    }
+    return here;
+  }
+
+  // With CHUNKS vectors of 64 positions, a constant so that they stay
+  // in registers
+  //
+  template <int CHUNKS>
+  __attribute__((target("avx512f,avx512bw"))) uint32_t predict_and_update_avx512(uint32_t pc, uint8_t outcome)
+  {
+    const int rows = 1 << path_bits;
+    const int length = history_length;
+    const __m512i zero = _mm512_setzero_si512();
+    int8_t *block = &weights[(size_t)(pc & addr_mask) * length << path_bits];
+
+    // Pick the weight of each position from the row of its path
+    // address, a level of blends for each bit of the addresses. Rows
+    // past the block are left zero, and the tree never picks them
+    __m512i selected[CHUNKS];
+    for (int c = 0; c < CHUNKS; c++)
+    {
+      __m512i level[PIECEWISE_TREE_ROWS];
+#pragma GCC unroll 16
+      for (int r = 0; r < PIECEWISE_TREE_ROWS; r++)
+      {
+        level[r] = (r < rows) ? _mm512_loadu_si512(&block[r * length + 64 * c]) : zero;
+      }
+#pragma GCC unroll 4
+      for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+      {
+#pragma GCC unroll 8
+        for (int j = 0; j < (PIECEWISE_TREE_ROWS >> b) / 2; j++)
+        {
+          level[j] = _mm512_mask_blend_epi8(path_window[b][c], level[2 * j], level[2 * j + 1]);
+        }
+      }
+      selected[c] = level[0];
+    }
+
+    // Sum them as unsigned bytes, offset by 128, taken positions added
+    // and the others subtracted
+    const __m512i offset = _mm512_set1_epi8((char)0x80);
+    __m512i sums = zero;
+    int balance = 0;
+    for (int c = 0; c < CHUNKS; c++)
+    {
+      __mmask64 taken = taken_window[c] & window_valid[c];
+      __mmask64 nottaken = ~taken_window[c] & window_valid[c];
+      __m512i biased = _mm512_xor_si512(selected[c], offset);
+      sums = _mm512_add_epi64(sums, _mm512_sub_epi64(_mm512_sad_epu8(_mm512_maskz_mov_epi8(taken, biased), zero),
+                                                     _mm512_sad_epu8(_mm512_maskz_mov_epi8(nottaken, biased), zero)));
+      balance += __builtin_popcountll(taken) - __builtin_popcountll(nottaken);
+    }
+    int sum = bias[pc & addr_mask] + (int)_mm512_reduce_add_epi64(sums) - 128 * balance;
+
+    uint8_t prediction = (sum >= 0) ? TAKEN : NOTTAKEN;
+    if (prediction != outcome || abs(sum) <= theta)
+    {
+      // +1 where the outcome at a position agrees with this one, -1
+      // elsewhere, saturating at WEIGHT_MIN and WEIGHT_MAX as int8 does
+      const __m512i one = _mm512_set1_epi8(1);
+      train_weight(&bias[pc & addr_mask], outcome);
+      for (int c = 0; c < CHUNKS; c++)
+      {
+        __mmask64 agree = (outcome ? taken_window[c] : ~taken_window[c]) & window_valid[c];
+        __mmask64 disagree = ~agree & window_valid[c];
+        selected[c] = _mm512_mask_adds_epi8(selected[c], agree, selected[c], one);
+        selected[c] = _mm512_mask_subs_epi8(selected[c], disagree, selected[c], one);
+      }
+#pragma GCC unroll 16
+      for (int r = 0; r < PIECEWISE_TREE_ROWS; r++)
+      {
+        for (int c = 0; c < CHUNKS && r < rows; c++)
+        {
+          _mm512_mask_storeu_epi8(&block[r * length + 64 * c], row_mask(r, c), selected[c]);
+        }
+      }
+    }
+
+    // Shift the branch into the masks, each chunk's oldest position
+    // carried into the next
+    uint64_t taken_in = outcome;
+    uint64_t path_in[PIECEWISE_TREE_BITS];
+    for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+    {
+      path_in[b] = ((pc & path_mask) >> b) & 1;
+    }
+    for (int c = 0; c < CHUNKS; c++)
+    {
+      uint64_t carried = taken_window[c] >> 63;
+      taken_window[c] = (taken_window[c] << 1) | taken_in;
+      taken_in = carried;
+      for (int b = 0; b < PIECEWISE_TREE_BITS; b++)
+      {
+        carried = path_window[b][c] >> 63;
+        path_window[b][c] = (path_window[b][c] << 1) | path_in[b];
+        path_in[b] = carried;
+      }
+    }
+    push(pc, outcome);
+    return prediction;
+  }
+#endif
+
+  uint32_t predict(uint32_t pc)
+  {
+    return (sum_scalar(pc) >= 0) ? TAKEN : NOTTAKEN;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+#ifdef __SSE2__
+    if (use_avx512)
+    {
+      return (history_length <= 64) ? predict_and_update_avx512<1>(pc, outcome)
+                                     : predict_and_update_avx512<2>(pc, outcome);
+    }
+    if (use_avx2)
+    {
+      return predict_and_update_avx2(pc, outcome);
+    }
+#endif
+    return predict_and_update_scalar(pc, outcome);
+  }
+
+  // A branch's weights follow from its PC, so its block is prefetched
+  // from the start
+  //
+  uint64_t global_history()
+  {
+    return 0;
+  }
+
+  void prefetch(uint32_t pc, uint64_t /* history */)
+  {
+    __builtin_prefetch(&weights[(size_t)(pc & addr_mask) * history_length << path_bits], 1);
+  }
+
+  uint64_t table_bytes()
+  {
+    return weight_count();
+  }
+};
+
+// An entry of a YAGS exception cache: the partial tag of a branch, a
+// 2-bit counter and the entry's age in its set, 0 for the most
+// recently used
+typedef struct
+{
+  uint16_t tag; // YAGS_INVALID while empty
+  uint8_t ctr;
+  uint8_t age;
+} yags_entry;
+
+#define YAGS_INVALID 0xffff
+
+// YAGS: a PC-indexed choice table gives each branch its bias, and two
+// small set-associative caches, indexed by the PC xor the global
+// history and tagged with the low PC bits, hold the exceptions. A
+// branch biased not taken looks up the taken cache and one biased
+// taken the not-taken cache; a hit predicts with the entry's counter,
+// a miss with the bias. An entry is allocated, over the least recently
+// used of its set, when the bias mispredicts and the cache missed.
+// The choice counter is not trained when it was wrong but a hit put
+// the prediction right.
+//
+class YagsPredictor : public Predictor<YagsPredictor>
+{
+public:
+  int choice_bits, set_bits, tag_bits, ways;
+  uint32_t choice_mask, set_mask, tag_mask;
+  Counters choice;
+  yags_entry *caches[2]; // by the outcome of their exceptions
+  uint64_t history;
+
+  void init(int choiceBits, int setBits, int tagBits, int numWays)
+  {
+    choice_bits = choiceBits;
+    set_bits = setBits;
+    tag_bits = tagBits;
+    ways = numWays;
+    choice_mask = (1 << choice_bits) - 1;
+    set_mask = (1 << set_bits) - 1;
+    tag_mask = (1 << tag_bits) - 1;
+    choice.init(1ULL << choice_bits, WN);
+    for (int c = 0; c < 2; c++)
+    {
+      caches[c] = (yags_entry *)malloc(cache_bytes());
+      for (uint64_t i = 0; i < ((uint64_t)ways << set_bits); i++)
+      {
+        caches[c][i].tag = YAGS_INVALID;
+        caches[c][i].ctr = WN;
+        caches[c][i].age = i % ways;
+      }
+    }
+    history = 0;
+  }
+
+  void release()
+  {
+    choice.release();
+    free(caches[0]);
+    free(caches[1]);
+    caches[0] = caches[1] = NULL;
+  }
+
+  // Bytes of one exception cache
+  //
+  uint64_t cache_bytes()
+  {
+    return sizeof(yags_entry) * ((uint64_t)ways << set_bits);
+  }
+
+  yags_entry *set_of(int cache, uint32_t pc, uint64_t future)
+  {
+    return &caches[cache][(size_t)((pc ^ (uint32_t)future) & set_mask) * ways];
+  }
+
+  // Returns the way of 'set' holding the branch at 'pc', or -1
+  //
+  int find(const yags_entry *set, uint32_t pc)
+  {
+    uint16_t tag = pc & tag_mask;
+    for (int w = 0; w < ways; w++)
+    {
+      if (set[w].tag == tag)
+      {
+        return w;
+      }
+    }
+    return -1;
+  }
+
+  // Make way 'w' the most recently used of its set
+  //
+  void touch(yags_entry *set, int w)
+  {
+    for (int i = 0; i < ways; i++)
+    {
+      set[i].age += (set[i].age < set[w].age);
+    }
+    set[w].age = 0;
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    uint32_t bias = Counters::taken(choice.get(pc & choice_mask)) ? TAKEN : NOTTAKEN;
+    const yags_entry *set = set_of(!bias, pc, history);
+    int w = find(set, pc);
+    if (w < 0)
+    {
+      return bias;
+    }
+    return Counters::taken(set[w].ctr) ? TAKEN : NOTTAKEN;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    uint64_t choice_counter = choice.get(pc & choice_mask);
+    uint32_t bias = Counters::taken(choice_counter) ? TAKEN : NOTTAKEN;
+    yags_entry *set = set_of(!bias, pc, history);
+    int w = find(set, pc);
+    uint32_t prediction = bias;
+    if (w >= 0)
+    {
+      prediction = Counters::taken(set[w].ctr) ? TAKEN : NOTTAKEN;
+      set[w].ctr = Counters::next(set[w].ctr, outcome);
+      touch(set, w);
+    }
+    else if (bias != outcome)
+    {
+      // Replace the least recently used way with the new exception
+      int victim = 0;
+      for (int i = 1; i < ways; i++)
+      {
+        victim = (set[i].age > set[victim].age) ? i : victim;
+      }
+      set[victim].tag = pc & tag_mask;
+      set[victim].ctr = outcome ? WT : WN;
+      touch(set, victim);
+    }
+
+    if (bias == outcome || prediction != outcome)
+    {
+      choice.set(pc & choice_mask, Counters::next(choice_counter, outcome));
+    }
+    history = (history << 1) | outcome;
+    return prediction;
+  }
+
+  uint64_t global_history()
+  {
+    return history;
+  }
+
+  // The bias is not known ahead, so both candidate sets are fetched
+  //
+  void prefetch(uint32_t pc, uint64_t future)
+  {
+    choice.prefetch(pc & choice_mask);
+    __builtin_prefetch(set_of(NOTTAKEN, pc, future), 1);
+    __builtin_prefetch(set_of(TAKEN, pc, future), 1);
+  }
+
+  uint64_t table_bytes()
+  {
+    return Counters::bytes(1ULL << choice_bits) + 2 * cache_bytes();
+  }
+};
+
+// Bi-mode: a PC-indexed choice table picks one of two direction
+// tables, both indexed like gshare, one biased not taken and the
+// other taken. Branches that alias in a direction table then mostly
+// share a bias, so the aliasing does less harm. Only the chosen
+// direction counter is trained, and the choice counter is left alone
+// when it went against the outcome but the chosen counter was right.
+//
+class BimodePredictor : public Predictor<BimodePredictor>
+{
+public:
+  int choice_bits, direction_bits;
+  uint32_t choice_mask, direction_mask;
+  Counters choice;
+  Counters direction; // the not-taken table, then the taken one
+  uint64_t history;
+  AliasCounter aliases;
+
+  void init(int choiceBits, int directionBits)
+  {
+    choice_bits = choiceBits;
+    direction_bits = directionBits;
+    choice_mask = (1 << choice_bits) - 1;
+    direction_mask = (1 << direction_bits) - 1;
+    choice.init(1ULL << choice_bits, WN);
+    direction.init(2ULL << direction_bits, WN);
+    for (uint64_t i = 1ULL << direction_bits; i < (2ULL << direction_bits); i++)
+    {
+      direction.set(i, WT);
+    }
+    history = 0;
+    aliases.init(2ULL << direction_bits);
+  }
+
+  void release()
+  {
+    choice.release();
+    direction.release();
+    aliases.release();
+  }
+
+  uint64_t direction_entry(uint32_t bias, uint32_t pc, uint64_t future)
+  {
+    return ((uint64_t)bias << direction_bits) | ((pc ^ (uint32_t)future) & direction_mask);
+  }
+
+  uint32_t predict(uint32_t pc)
+  {
+    uint32_t bias = Counters::taken(choice.get(pc & choice_mask)) ? TAKEN : NOTTAKEN;
+    return Counters::taken(direction.get(direction_entry(bias, pc, history))) ? TAKEN : NOTTAKEN;
+  }
+
+  void update(uint32_t pc, uint8_t outcome)
+  {
+    predict_and_update(pc, outcome);
+  }
+
+  uint32_t predict_and_update(uint32_t pc, uint8_t outcome)
+  {
+    uint64_t choice_counter = choice.get(pc & choice_mask);
+    uint32_t bias = Counters::taken(choice_counter) ? TAKEN : NOTTAKEN;
+    uint64_t entry = direction_entry(bias, pc, history);
+    uint32_t prediction = Counters::taken(direction.step(entry, outcome)) ? TAKEN : NOTTAKEN;
+    if (bias == outcome || prediction != outcome)
+    {
+      choice.set(pc & choice_mask, Counters::next(choice_counter, outcome));
+    }
+    history = (history << 1) | outcome;
+    if (aliases.owners != NULL)
+    {
+      aliases.note(entry, pc, prediction != outcome);
+    }
+    return prediction;
+  }
+
+  uint64_t global_history()
+  {
+    return history;
+  }
+
+  // The choice is not known ahead, so both direction entries are
+  // fetched
+  //
+  void prefetch(uint32_t pc, uint64_t future)
+  {
+    choice.prefetch(pc & choice_mask);
+    direction.prefetch(direction_entry(NOTTAKEN, pc, future));
+    direction.prefetch(direction_entry(TAKEN, pc, future));
+  }
+
+  uint64_t table_bytes()
+  {
+    return Counters::bytes(1ULL << choice_bits) + Counters::bytes(2ULL << direction_bits);
+  }
+};
+
+#endif
@@ -0,0 +1,517 @@
+//========================================================//
+//  simulate.cpp                                          //
+//  Source file for running predictor configurations     //
+//  over traces                                           //
+//                                                        //
+//  Every trace is read a batch at a time and each batch  //
+//  is handed to all the configurations of a pass         //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simulate.h"
+#include "trace.h"
+#include "trace_cache.h"
+#include "job_pool.h"
+
+uint64_t skip_branches = 0;
+uint64_t count_branches = 0;
+predictor_context default_config;
+const char *load_state_path = NULL;
+const char *save_state_path = NULL;
+int shard_threads = -1;
+alias_stats trace_aliasing;
+int trace_aliasing_counted = 0;
+
+//------------------------------------//
+//           Configurations           //
+//------------------------------------//
+
+// Parse the sizes of 'args' (":<n>:<n>...") into sizes[0, max_count)
+//
+// Returns the number of sizes, 0 if 'args' is malformed
+//
+static int parse_sizes(const char *args, int *sizes, int max_count)
+{
+  int count = 0;
+  while (*args != '\0')
+  {
+    int len = 0;
+    if (count == max_count || sscanf(args, ":%d%n", &sizes[count], &len) != 1 || sizes[count] < 1)
+    {
+      return 0;
+    }
+    args += len;
+    count++;
+  }
+  return count;
+}
+
+// Assign sizes[0, n) to the configuration variables 'fields' points
+// to, keeping them only if 'valid' accepts the resulting configuration
+//
+// Returns True if it does; otherwise the variables keep their values
+//
+static int set_sizes(int *const *fields, int count, const int *sizes, int n, int (*valid)())
+{
+  int saved[5];
+  for (int i = 0; i < count; i++)
+  {
+    saved[i] = *fields[i];
+  }
+  for (int i = 0; i < n; i++)
+  {
+    *fields[i] = sizes[i];
+  }
+  if (!valid())
+  {
+    for (int i = 0; i < count; i++)
+    {
+      *fields[i] = saved[i];
+    }
+    return 0;
+  }
+  return 1;
+}
+
+int parse_config(const char *config)
+{
+  const char *args = strchr(config, ':');
+  size_t len = (args != NULL) ? (size_t)(args - config) : strlen(config);
+  int sizes[5];
+  int n = (args != NULL) ? parse_sizes(args, sizes, 5) : 0;
+
+  // Table sizes are log2 of the entries, except for the perceptron and
+  // piecewise-linear predictors, whose sizes their validators check
+  int perceptron = (len == 10 && !strncmp(config, "perceptron", len));
+  int piecewise = (len == 9 && !strncmp(config, "piecewise", len));
+  for (int i = 0; i < n && i < 3 && !perceptron && !piecewise; i++)
+  {
+    if (sizes[i] > 30)
+    {
+      return 0;
+    }
+  }
+
+  threadConfigured = 1;
+  if (len == 6 && !strncmp(config, "static", len) && args == NULL)
+  {
+    predictorType = STATIC;
+  }
+  else if (len == 6 && !strncmp(config, "gshare", len) && (args == NULL || n == 1))
+  {
+    predictorType = GSHARE;
+    if (n == 1)
+    {
+      ghistoryBitsGshare = sizes[0];
+    }
+  }
+  else if (len == 10 && !strncmp(config, "tournament", len) && (args == NULL || n == 3))
+  {
+    predictorType = TOURNAMENT;
+    if (n == 3)
+    {
+      ghistoryBitsTournament = sizes[0];
+      lhistoryBitsTournament = sizes[1];
+      chooserBitsTournament = sizes[2];
+    }
+  }
+  else if (len == 6 && !strncmp(config, "custom", len) && (args == NULL || n == 3 || n == 5))
+  {
+    if (n == 5 && (sizes[3] > 31 || sizes[4] > (1 << 16)))
+    {
+      return 0;
+    }
+    predictorType = CUSTOM;
+    if (n >= 3)
+    {
+      ghistoryBitsCustom = sizes[0];
+      lhistoryBitsCustom = sizes[1];
+      chooserBitsCustom = sizes[2];
+    }
+    if (n == 5)
+    {
+      historyLength = sizes[3];
+      numPerceptrons = sizes[4];
+    }
+  }
+  else if (len == 4 && !strncmp(config, "tage", len) && (args == NULL || n == 4 || n == 5))
+  {
+    int *const fields[5] = {&tageBaseBits, &tageTables, &tageTableBits, &tageTagBits, &tageMaxHistory};
+    if (!set_sizes(fields, 5, sizes, n, tage_config_valid))
+    {
+      return 0;
+    }
+    predictorType = TAGE;
+  }
+  else if (perceptron && (args == NULL || n == 3))
+  {
+    int *const fields[3] = {&perceptronTables, &perceptronTableBits, &perceptronHistory};
+    if (!set_sizes(fields, 3, sizes, n, perceptron_config_valid))
+    {
+      return 0;
+    }
+    predictorType = PERCEPTRON;
+  }
+  else if (piecewise && (args == NULL || n == 3))
+  {
+    int *const fields[3] = {&piecewiseAddrBits, &piecewisePathBits, &piecewiseHistory};
+    if (!set_sizes(fields, 3, sizes, n, piecewise_config_valid))
+    {
+      return 0;
+    }
+    predictorType = PIECEWISE;
+  }
+  else if (len == 4 && !strncmp(config, "yags", len) && (args == NULL || n == 4))
+  {
+    int *const fields[4] = {&yagsChoiceBits, &yagsSetBits, &yagsTagBits, &yagsWays};
+    if (!set_sizes(fields, 4, sizes, n, yags_config_valid))
+    {
+      return 0;
+    }
+    predictorType = YAGS;
+  }
+  else if (len == 6 && !strncmp(config, "bimode", len) && (args == NULL || n == 2))
+  {
+    int *const fields[2] = {&choiceBitsBimode, &directionBitsBimode};
+    if (!set_sizes(fields, 2, sizes, n, bimode_config_valid))
+    {
+      return 0;
+    }
+    predictorType = BIMODE;
+  }
+  else
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+//------------------------------------//
+//         Trace Simulation           //
+//------------------------------------//
+
+// Cut 'batch' after its 'remaining'-th conditional branch
+//
+static void trim_batch(trace_batch *batch, uint64_t remaining)
+{
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if ((batch->flags[i] & BR_CONDITION) && --remaining == 0)
+    {
+      batch->count = i + 1;
+      return;
+    }
+  }
+}
+
+// Conditional branches of a trace, kept for a sharded run
+typedef struct
+{
+  uint32_t *pcs;
+  uint8_t *outcomes;
+  uint32_t count;
+  uint32_t capacity;
+} branch_list;
+
+// Append the conditional branches of 'batch' to 'list'
+//
+// Returns the number appended
+//
+static uint32_t append_branches(branch_list *list, const trace_batch *batch)
+{
+  uint32_t start = list->count;
+  for (size_t i = 0; i < batch->count; i++)
+  {
+    if (!(batch->flags[i] & BR_CONDITION))
+    {
+      continue;
+    }
+    if (list->count == list->capacity)
+    {
+      list->capacity = (list->capacity > 0) ? 2 * list->capacity : TRACE_BATCH_SIZE;
+      list->pcs = (uint32_t *)realloc(list->pcs, list->capacity * sizeof(uint32_t));
+      list->outcomes = (uint8_t *)realloc(list->outcomes, list->capacity);
+    }
+    list->pcs[list->count] = batch->pc[i];
+    list->outcomes[list->count] = batch->flags[i] & BR_OUTCOME;
+    list->count++;
+  }
+  return list->count - start;
+}
+
+// Start the current predictor from, or save it to, the state file
+// at 'path'
+//
+// Returns True if Successful
+//
+static int load_state(const char *path)
+{
+  FILE *stream = fopen(path, "rb");
+  if (stream == NULL)
+  {
+    fprintf(stderr, "Unable to open state %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  int ok = load_predictor_state(stream);
+  fclose(stream);
+  if (!ok)
+  {
+    fprintf(stderr, "Invalid predictor state %s\n", path);
+  }
+  return ok;
+}
+
+static int save_state(const char *path)
+{
+  FILE *stream = fopen(path, "wb");
+  int ok = (stream != NULL) && save_predictor_state(stream);
+  if (stream != NULL && fclose(stream) != 0)
+  {
+    ok = 0;
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "Unable to write state %s: %s\n", path, strerror(errno));
+  }
+  return ok;
+}
+
+int simulate_trace(const char *path, char **configs, int num_configs, uint32_t *num_branches, uint32_t *mispredictions)
+{
+  trace_reader *reader = trace_cache_open(path, skip_branches);
+  if (reader == NULL)
+  {
+    fprintf(stderr, "Unable to open trace %s: %s\n", path ? path : "-", strerror(errno));
+    return 0;
+  }
+
+  // Initialize the predictor, or one per configuration
+  int num_contexts = (configs != NULL) ? num_configs : 1;
+  predictor_context *contexts = (predictor_context *)malloc(num_contexts * sizeof(predictor_context));
+  for (int i = 0; i < num_contexts; i++)
+  {
+    if (configs != NULL)
+    {
+      load_predictor(&default_config);
+      parse_config(configs[i]);
+    }
+    if (configs == NULL && load_state_path != NULL)
+    {
+      if (!load_state(load_state_path))
+      {
+        free_predictor();
+        free(contexts);
+        trace_close(reader);
+        return 0;
+      }
+    }
+    else
+    {
+      init_predictor();
+    }
+    save_predictor(&contexts[i]);
+    mispredictions[i] = 0;
+  }
+
+  // The gshare configurations of a sweep run as lanes of one pass
+  int *lanes = (int *)malloc(num_contexts * sizeof(int));
+  int num_lanes = 0;
+  for (int i = 0; configs != NULL && gshareLanes != LANES_OFF && i < num_contexts; i++)
+  {
+    load_predictor(&contexts[i]);
+    if (predictorType == GSHARE)
+    {
+      lanes[num_lanes++] = i;
+    }
+  }
+  if (num_lanes < 2)
+  {
+    num_lanes = 0;
+  }
+
+  *num_branches = 0;
+  trace_batch batch;
+  trace_batch_init(&batch, TRACE_BATCH_SIZE);
+  int sharded = (configs == NULL && shard_threads >= 0);
+  branch_list branches = {NULL, NULL, 0, 0};
+  uint8_t *predictions = (verbose && configs == NULL && !sharded) ? (uint8_t *)malloc(TRACE_BATCH_SIZE) : NULL;
+
+  // Simulate the trace a batch of branches at a time, handing every
+  // batch to each predictor in turn. A sharded run reads the whole
+  // trace first.
+  while ((count_branches == 0 || *num_branches < count_branches) && trace_next_batch(reader, &batch) > 0)
+  {
+    if (count_branches > 0)
+    {
+      trim_batch(&batch, count_branches - *num_branches);
+    }
+    if (sharded)
+    {
+      *num_branches += append_branches(&branches, &batch);
+      continue;
+    }
+    uint32_t batch_branches = 0;
+    for (int l = 0; l < num_lanes; l += GSHARE_LANES)
+    {
+      int count = (num_lanes - l < GSHARE_LANES) ? num_lanes - l : GSHARE_LANES;
+      simulate_gshare_lanes(&batch, contexts, &lanes[l], count, &batch_branches, mispredictions);
+    }
+    for (int i = 0, l = 0; i < num_contexts; i++)
+    {
+      if (l < num_lanes && lanes[l] == i)
+      {
+        l++;
+        continue;
+      }
+      batch_branches = 0;
+      load_predictor(&contexts[i]);
+      simulate_batch(&batch, predictions, &batch_branches, &mispredictions[i]);
+      save_predictor(&contexts[i]);
+    }
+    for (uint32_t i = 0; predictions != NULL && i < batch_branches; i++)
+    {
+      printf("%d\n", predictions[i]);
+    }
+    *num_branches += batch_branches;
+  }
+
+  if (sharded)
+  {
+    load_predictor(&contexts[0]);
+    predictions = verbose ? (uint8_t *)malloc(branches.count) : NULL;
+    simulate_sharded(branches.pcs, branches.outcomes, branches.count,
+                     (shard_threads > 0) ? shard_threads : sysconf(_SC_NPROCESSORS_ONLN),
+                     predictions, &mispredictions[0]);
+    save_predictor(&contexts[0]);
+    for (uint32_t i = 0; predictions != NULL && i < branches.count; i++)
+    {
+      printf("%d\n", predictions[i]);
+    }
+    free(branches.pcs);
+    free(branches.outcomes);
+  }
+
+  int ok = 1;
+  if (configs == NULL && save_state_path != NULL)
+  {
+    load_predictor(&contexts[0]);
+    ok = save_state(save_state_path);
+  }
+  if (configs == NULL)
+  {
+    load_predictor(&contexts[0]);
+    trace_aliasing_counted = predictor_alias_stats(&trace_aliasing);
+  }
+
+  // Cleanup
+  for (int i = 0; i < num_contexts; i++)
+  {
+    load_predictor(&contexts[i]);
+    free_predictor();
+  }
+  free(contexts);
+  free(lanes);
+  trace_batch_free(&batch);
+  free(predictions);
+  trace_close(reader);
+
+  return ok;
+}
+
+
+//------------------------------------//
+//          Multi-Trace Runs          //
+//------------------------------------//
+
+// A job simulates a group of configurations on one trace
+typedef struct
+{
+  const char *path;
+  char **configs;
+  int num_configs;
+  int64_t size; // of the trace file, to run long jobs first
+  sim_result *results;
+} sim_job;
+
+static void run_job(int job, void *arg)
+{
+  sim_job *j = &((sim_job *)arg)[job];
+  uint32_t num_branches = 0;
+  uint32_t *mispredictions = (uint32_t *)calloc(j->num_configs, sizeof(uint32_t));
+  int ok = simulate_trace(j->path, j->configs, j->num_configs, &num_branches, mispredictions);
+  for (int i = 0; i < j->num_configs; i++)
+  {
+    j->results[i].num_branches = num_branches;
+    j->results[i].mispredictions = mispredictions[i];
+    j->results[i].ok = ok;
+  }
+  free(mispredictions);
+}
+
+static sim_job *sort_jobs;
+
+static int compare_job_size(const void *a, const void *b)
+{
+  int64_t x = sort_jobs[*(const int *)a].size;
+  int64_t y = sort_jobs[*(const int *)b].size;
+  return (x < y) - (x > y);
+}
+
+void simulate_all(const char **traces, int num_traces, char **configs, int num_configs,
+                  int group, int threads, sim_result *results)
+{
+  int groups = (num_configs + group - 1) / group;
+  int total = num_traces * groups;
+  sim_job *jobs = (sim_job *)calloc(total, sizeof(sim_job));
+  int *order = (int *)malloc(total * sizeof(int));
+  for (int t = 0; t < num_traces; t++)
+  {
+    struct stat st;
+    int64_t size = (stat(traces[t], &st) == 0) ? st.st_size : 0;
+    for (int g = 0; g < groups; g++)
+    {
+      sim_job *j = &jobs[t * groups + g];
+      j->path = traces[t];
+      j->configs = &configs[g * group];
+      j->num_configs = (g == groups - 1) ? num_configs - g * group : group;
+      j->size = size;
+      j->results = &results[t * num_configs + g * group];
+      order[t * groups + g] = t * groups + g;
+    }
+  }
+  sort_jobs = jobs;
+  qsort(order, total, sizeof(int), compare_job_size);
+
+  job_pool_run((threads > 0) ? threads : sysconf(_SC_NPROCESSORS_ONLN), order, total, run_job, jobs);
+
+  free(jobs);
+  free(order);
+}
+
+int mean_rates(const sim_result *results, int num_traces, int num_configs, int config,
+               double *mean, double *geomean)
+{
+  double sum = 0, log_sum = 0;
+  int n = 0, zero = 0;
+  for (int t = 0; t < num_traces; t++)
+  {
+    const sim_result *r = &results[t * num_configs + config];
+    if (r->ok && r->num_branches > 0)
+    {
+      double rate = 1000 * ((double)r->mispredictions / (double)r->num_branches);
+      sum += rate;
+      zero |= (rate == 0);
+      log_sum += (rate > 0) ? log(rate) : 0;
+      n++;
+    }
+  }
+  *mean = (n > 0) ? sum / n : 0;
+  *geomean = (n > 0 && !zero) ? exp(log_sum / n) : 0;
+  return n;
+}
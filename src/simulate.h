@@ -0,0 +1,85 @@
+//========================================================//
+//  simulate.h                                            //
+//  Header file for running predictor configurations     //
+//  over traces                                           //
+//========================================================//
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Window of conditional branches to simulate; 0 branches runs to the
+// end of the trace
+extern uint64_t skip_branches;
+extern uint64_t count_branches;
+
+// Predictor state files (--load-state, --save-state) of a run of the
+// current configuration; NULL when not used
+extern const char *load_state_path;
+extern const char *save_state_path;
+
+// Threads simulating the current configuration in table shards
+// (--sharded): 0 for one per core, -1 to simulate batch by batch
+extern int shard_threads;
+
+// Aliasing counts of the current configuration at the end of the last
+// simulate_trace, and whether its predictor counted them (see
+// countAliasing)
+extern alias_stats trace_aliasing;
+extern int trace_aliasing_counted;
+
+// Configuration that the configurations of parse_config start from
+extern predictor_context default_config;
+
+typedef struct
+{
+  uint32_t num_branches;
+  uint32_t mispredictions;
+  int ok;
+} sim_result;
+
+// Set the predictor type and sizes from a configuration: static,
+// gshare[:<ghistoryBits>], tournament[:<ghistoryBits>:<lhistoryBits>:<chooserBits>]
+// custom[:<ghistoryBits>:<lhistoryBits>:<chooserBits>[:<historyLength>:<numPerceptrons>]]
+// tage[:<baseBits>:<numTables>:<tableBits>:<tagBits>[:<maxHistory>]]
+// perceptron[:<numTables>:<tableBits>:<historyLength>],
+// piecewise[:<addrBits>:<pathBits>:<historyLength>],
+// yags[:<choiceBits>:<setBits>:<tagBits>:<ways>]
+// or bimode[:<choiceBits>:<directionBits>].
+// Omitted sizes keep their current values.
+//
+// Returns True if Successful
+//
+int parse_config(const char *config);
+
+// Simulate the configurations configs[0, num_configs), or the current
+// one when 'configs' is NULL, on one pass over the trace at 'path'.
+// The current configuration starts from load_state_path and is saved
+// to save_state_path when those are set, and is simulated with
+// simulate_sharded unless shard_threads is -1.
+// Stores the number of conditional branches in '*num_branches' and
+// the mispredictions of each configuration in 'mispredictions'.
+//
+// Returns True if Successful
+//
+int simulate_trace(const char *path, char **configs, int num_configs, uint32_t *num_branches, uint32_t *mispredictions);
+
+// Simulate every configuration on every trace on 'threads' threads
+// (0 for one per core) into results[trace * num_configs + config].
+// Each job makes one pass over a trace for up to 'group'
+// configurations.
+//
+void simulate_all(const char **traces, int num_traces, char **configs, int num_configs,
+                  int group, int threads, sim_result *results);
+
+// Mean and geometric mean misprediction rate of a configuration over
+// the traces it ran on
+//
+// Returns the number of those traces
+//
+int mean_rates(const sim_result *results, int num_traces, int num_configs, int config,
+               double *mean, double *geomean);
+
+#endif
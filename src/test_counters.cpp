@@ -0,0 +1,141 @@
+//========================================================//
+//  test_counters.cpp                                     //
+//  Test of the packed saturating counters                //
+//                                                        //
+//  At 1, 3 and 5 bits, a CounterArray is set and         //
+//  stepped at random, and after every operation each     //
+//  counter must equal that of a plain uint8_t array,     //
+//  so that a counter saturates at 0 and MAX and never    //
+//  disturbs its neighbours, across word boundaries too   //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "counters.h"
+
+// Counters per table, many words at every width and not a whole
+// number of them
+#define TEST_ENTRIES 1000
+
+// Random operations per table
+#define TEST_STEPS 200000
+
+// The reference of CounterArray::step: 'value' moved one step towards
+// 'outcome', saturating at 0 and 'max'
+//
+static uint8_t reference_step(uint8_t value, uint32_t outcome, uint8_t max)
+{
+  if (outcome)
+  {
+    return (value < max) ? value + 1 : value;
+  }
+  return (value > 0) ? value - 1 : value;
+}
+
+// Returns the first counter that differs from the reference, or -1
+//
+template <int BITS>
+static long first_difference(const CounterArray<BITS> &counters, const uint8_t *reference)
+{
+  for (long i = 0; i < TEST_ENTRIES; i++)
+  {
+    if (counters.get(i) != reference[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+template <int BITS>
+static int check_counters()
+{
+  typedef CounterArray<BITS> Array;
+  const uint8_t max = (uint8_t)Array::MAX;
+
+  // Every counter of a word used, none straddling two
+  if (Array::PER_WORD * BITS > 64 || (Array::PER_WORD + 1) * BITS <= 64)
+  {
+    printf("FAIL %d bits: %d counters per word\n", BITS, Array::PER_WORD);
+    return 0;
+  }
+  uint64_t bytes = Array::bytes(TEST_ENTRIES);
+  if (bytes % COUNTER_LINE != 0 || bytes * 8 < (uint64_t)TEST_ENTRIES * BITS)
+  {
+    printf("FAIL %d bits: %llu bytes for %d counters\n", BITS, (unsigned long long)bytes, TEST_ENTRIES);
+    return 0;
+  }
+
+  // Prediction from the upper half, and saturation of next() at the
+  // ends
+  for (int value = 0; value <= max; value++)
+  {
+    if (Array::taken(value) != (value >= (max + 1) / 2) ||
+        Array::next(value, 1) != reference_step(value, 1, max) ||
+        Array::next(value, 0) != reference_step(value, 0, max))
+    {
+      printf("FAIL %d bits: value %d\n", BITS, value);
+      return 0;
+    }
+  }
+
+  Array counters;
+  uint8_t reference[TEST_ENTRIES];
+  counters.init(TEST_ENTRIES, max);
+  for (int i = 0; i < TEST_ENTRIES; i++)
+  {
+    reference[i] = max;
+  }
+
+  int ok = (first_difference(counters, reference) < 0);
+  srand(BITS);
+  for (int n = 0; ok && n < TEST_STEPS; n++)
+  {
+    long i = rand() % TEST_ENTRIES;
+    int op = rand() % 8;
+    if (op == 0)
+    {
+      // Mostly the ends, where a stray carry or borrow would show
+      uint8_t value = (rand() & 1) ? ((rand() & 1) ? max : 0) : rand() % (max + 1);
+      counters.set(i, value);
+      reference[i] = value;
+    }
+    else
+    {
+      // Either way, so that counters set to an end are also stepped
+      // past it
+      uint32_t outcome = op & 1;
+      if (counters.step(i, outcome) != reference[i])
+      {
+        printf("FAIL %d bits: step %d returned a wrong value for counter %ld\n", BITS, n, i);
+        ok = 0;
+      }
+      reference[i] = reference_step(reference[i], outcome, max);
+    }
+    long bad = first_difference(counters, reference);
+    if (bad >= 0)
+    {
+      printf("FAIL %d bits: counter %ld is %llu after step %d, expected %d\n", BITS, bad,
+             (unsigned long long)counters.get(bad), n, reference[bad]);
+      ok = 0;
+    }
+  }
+  counters.release();
+
+  if (ok)
+  {
+    printf("ok   %d bits: %d steps\n", BITS, TEST_STEPS);
+  }
+  return ok;
+}
+
+int main()
+{
+  int ok = check_counters<1>();
+  ok &= check_counters<3>();
+  ok &= check_counters<5>();
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
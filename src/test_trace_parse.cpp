@@ -0,0 +1,404 @@
+//========================================================//
+//  test_trace_parse.cpp                                  //
+//  Test of the text trace parser and readers            //
+//                                                        //
+//  Every record trace_parse_block produces with each     //
+//  delimiter scanner must match the sscanf reference     //
+//  trace_parse_line, line for line. Every record the     //
+//  readers give for a bundled trace, bzip2 and text,     //
+//  on one and on several threads, must match those of    //
+//  read_branch() of the original main.cpp                //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bzlib.h>
+#include "trace.h"
+
+static const char *parserName[3] = {"scalar", "sse2", "avx2"};
+
+// Records per trace_parse_block call, small enough that a trace takes
+// many calls
+#define TEST_RECORDS 1000
+
+// Spaces in the long line of the long line check, more than the 1 MB
+// the readers read or decompress at once
+#define LONG_LINE (3 << 20)
+
+// Decoder threads of the parallel bzip2 reader, more than one so that
+// lines split across blocks are stitched
+#define TEST_THREADS 4
+
+// Odd lines that the block decoder leaves to trace_parse_line:
+// uppercase hex, spaces, a line past 256 bytes, short and junk lines,
+// and a last line without a newline
+static const char oddText[] =
+  "0x1a2b\t0x3c4d\t1\t1\t0\t0\t1\n"
+  "0X1A2B\t0x3C4D\t0\t1\t0\t0\t1\n"
+  "0x10 \t0x20\t1\t1\t0\t0\t0\n"
+  "0x30\t0x40\t10\t1\t0\t0\t1\n"
+  "0x50\t0x60\t1\t1\t0\t0\t1"
+  "                                                                "
+  "                                                                "
+  "                                                                "
+  "                                                                \n"
+  "0x70\t0x80\t1\t1\n"
+  "junk\n"
+  "\n"
+  "0x123456789\t0x1\t1\t1\t0\t0\t1\n"
+  "0xffffffff\t0x0\t0\t1\t1\t0\t1";
+
+//------------------------------------//
+//             Helpers                //
+//------------------------------------//
+
+// Decompress the bzip2 file at 'path' into a buffer followed by
+// TRACE_PARSE_PADDING zero bytes
+//
+// Returns the buffer, or NULL
+//
+static char *read_bz2(const char *path, size_t *size)
+{
+  FILE *stream = fopen(path, "rb");
+  if (stream == NULL)
+  {
+    return NULL;
+  }
+  int bzerror;
+  BZFILE *bz = BZ2_bzReadOpen(&bzerror, stream, 0, 0, NULL, 0);
+  size_t capacity = 1 << 20, fill = 0;
+  char *text = (char *)malloc(capacity + TRACE_PARSE_PADDING);
+  while (bzerror == BZ_OK)
+  {
+    if (capacity - fill < (1 << 16))
+    {
+      capacity *= 2;
+      text = (char *)realloc(text, capacity + TRACE_PARSE_PADDING);
+    }
+    fill += BZ2_bzRead(&bzerror, bz, text + fill, 1 << 16);
+  }
+  BZ2_bzReadClose(NULL, bz);
+  fclose(stream);
+  if (bzerror != BZ_STREAM_END)
+  {
+    free(text);
+    return NULL;
+  }
+  memset(text + fill, 0, TRACE_PARSE_PADDING);
+  *size = fill;
+  return text;
+}
+
+// Parse text[0, size) a line at a time with trace_parse_line
+//
+// Returns the number of records
+//
+static size_t parse_reference(const char *text, size_t size, trace_record **records)
+{
+  size_t count = 0, capacity = 1024;
+  *records = (trace_record *)malloc(capacity * sizeof(trace_record));
+  for (size_t pos = 0; pos < size;)
+  {
+    const char *end = (const char *)memchr(text + pos, '\n', size - pos);
+    size_t len = (end != NULL) ? (size_t)(end - text) - pos : size - pos;
+    char *line = (char *)malloc(len + 1);
+    memcpy(line, text + pos, len);
+    line[len] = '\0';
+    if (count == capacity)
+    {
+      capacity *= 2;
+      *records = (trace_record *)realloc(*records, capacity * sizeof(trace_record));
+    }
+    count += trace_parse_line(line, &(*records)[count]);
+    free(line);
+    pos += len + 1;
+  }
+  return count;
+}
+
+// Parse text[0, size) the way read_branch() of the original main.cpp
+// does: getline, then sscanf with its result ignored, so that every
+// line is a record and the fields it does not convert keep their
+// values from the line before
+//
+// Returns the number of records
+//
+static size_t read_branch_reference(const char *text, size_t size, trace_record **records)
+{
+  uint32_t pc = 0, target = 0;
+  int outcome = 0, condition = 0, call = 0, ret = 0, direct = 0;
+  size_t count = 0, capacity = 1024;
+  size_t line_capacity = 256;
+  char *line = (char *)malloc(line_capacity);
+  *records = (trace_record *)malloc(capacity * sizeof(trace_record));
+  for (size_t pos = 0; pos < size;)
+  {
+    // A line keeps its newline, as with getline
+    const char *end = (const char *)memchr(text + pos, '\n', size - pos);
+    size_t len = (end != NULL) ? (size_t)(end - text) - pos + 1 : size - pos;
+    if (len >= line_capacity)
+    {
+      line_capacity = len + 1;
+      line = (char *)realloc(line, line_capacity);
+    }
+    memcpy(line, text + pos, len);
+    line[len] = '\0';
+    sscanf(line, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", &pc, &target, &outcome, &condition, &call, &ret,
+           &direct);
+    pos += len;
+
+    if (count == capacity)
+    {
+      capacity *= 2;
+      *records = (trace_record *)realloc(*records, capacity * sizeof(trace_record));
+    }
+    trace_record *rec = &(*records)[count++];
+    rec->pc = pc;
+    rec->target = target;
+    rec->flags = (outcome ? BR_OUTCOME : 0) | (condition ? BR_CONDITION : 0) | (call ? BR_CALL : 0) |
+                 (ret ? BR_RET : 0) | (direct ? BR_DIRECT : 0);
+  }
+  free(line);
+  return count;
+}
+
+// Write data[0, size) to a new temporary file
+//
+// Returns its path (malloc'd), or NULL
+//
+static char *write_temp(const char *data, size_t size)
+{
+  char *path = strdup("/tmp/test_trace_parse.XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    free(path);
+    return NULL;
+  }
+  FILE *stream = fdopen(fd, "wb");
+  int ok = (fwrite(data, 1, size, stream) == size);
+  ok &= (fclose(stream) == 0);
+  if (!ok)
+  {
+    unlink(path);
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+// Read the whole trace at 'path' with trace_open and trace_next, on
+// 'threads' decoder threads, and compare with the reference
+//
+// Returns True if every record matches
+//
+static int check_reader(const char *name, const char *path, int threads, const trace_record *expected,
+                        size_t num_expected)
+{
+  traceThreads = threads;
+  trace_reader *reader = trace_open(path);
+  if (reader == NULL)
+  {
+    printf("FAIL %s: unable to open\n", name);
+    return 0;
+  }
+  const char *format = traceFormatName[trace_format(reader)];
+  trace_record rec;
+  size_t count = 0;
+  int ok = 1;
+  while (trace_next(reader, &rec))
+  {
+    if (count >= num_expected || rec.pc != expected[count].pc || rec.target != expected[count].target ||
+        rec.flags != expected[count].flags)
+    {
+      printf("FAIL %s (%s, %d threads): record %zu differs from read_branch()\n", name, format, threads, count);
+      ok = 0;
+      break;
+    }
+    count++;
+  }
+  trace_close(reader);
+  if (ok && count != num_expected)
+  {
+    printf("FAIL %s (%s, %d threads): %zu records, read_branch() gives %zu\n", name, format, threads, count,
+           num_expected);
+    ok = 0;
+  }
+  if (ok)
+  {
+    printf("ok   %s (%s, %d threads): %zu records\n", name, format, threads, count);
+  }
+  return ok;
+}
+
+// Check the readers on the bzip2 trace 'name' at 'path', whose text
+// is text[0, size), on one and on several threads, and on that text
+// written to a file
+//
+// Returns True if all of them match read_branch()
+//
+static int check_readers(const char *name, const char *path, const char *text, size_t size)
+{
+  trace_record *expected;
+  size_t num_expected = read_branch_reference(text, size, &expected);
+  int ok = 1;
+  char *text_path = write_temp(text, size);
+  if (text_path == NULL)
+  {
+    printf("FAIL %s: unable to write its text\n", name);
+    ok = 0;
+  }
+  ok &= check_reader(name, path, 1, expected, num_expected);
+  ok &= check_reader(name, path, TEST_THREADS, expected, num_expected);
+  if (text_path != NULL)
+  {
+    ok &= check_reader(name, text_path, 1, expected, num_expected);
+    unlink(text_path);
+    free(text_path);
+  }
+  free(expected);
+  return ok;
+}
+
+// Check the readers on a trace with a line longer than their buffers,
+// between two ordinary lines
+//
+// Returns True if they give the records of read_branch()
+//
+static int check_long_line()
+{
+  const char head[] = "0x1a2b\t0x3c4d\t1\t1\t0\t0\t1\n0x50\t0x60\t1\t1\t0\t0\t1";
+  const char tail[] = "\n0x70\t0x80\t0\t1\t0\t0\t1\n";
+  size_t size = sizeof(head) - 1 + LONG_LINE + sizeof(tail) - 1;
+  char *text = (char *)malloc(size);
+  memcpy(text, head, sizeof(head) - 1);
+  memset(text + sizeof(head) - 1, ' ', LONG_LINE);
+  memcpy(text + size - (sizeof(tail) - 1), tail, sizeof(tail) - 1);
+
+  unsigned int compressed_size = size;
+  char *compressed = (char *)malloc(compressed_size);
+  int ok = 0;
+  if (BZ2_bzBuffToBuffCompress(compressed, &compressed_size, text, size, 9, 0, 0) == BZ_OK)
+  {
+    char *path = write_temp(compressed, compressed_size);
+    if (path != NULL)
+    {
+      ok = check_readers("long line", path, text, size);
+      unlink(path);
+      free(path);
+    }
+  }
+  if (!ok)
+  {
+    printf("FAIL long line\n");
+  }
+  free(compressed);
+  free(text);
+  return ok;
+}
+
+// Parse text[0, size) with trace_parse_block and the current scanner,
+// the way the trace readers do, and compare with the reference
+//
+// Returns True if every record matches
+//
+static int check_blocks(const char *name, const char *text, size_t size, const trace_record *expected,
+                        size_t num_expected)
+{
+  trace_record records[TEST_RECORDS];
+  size_t pos = 0, count = 0;
+  while (pos < size)
+  {
+    size_t n;
+    size_t used = trace_parse_block(text + pos, size - pos, records, TEST_RECORDS, &n);
+    if (n == 0 && used == 0)
+    {
+      // A last line without a newline
+      char *line = (char *)malloc(size - pos + 1);
+      memcpy(line, text + pos, size - pos);
+      line[size - pos] = '\0';
+      n = trace_parse_line(line, &records[0]);
+      free(line);
+      used = size - pos;
+    }
+    for (size_t i = 0; i < n; i++, count++)
+    {
+      if (count >= num_expected || records[i].pc != expected[count].pc ||
+          records[i].target != expected[count].target || records[i].flags != expected[count].flags)
+      {
+        printf("FAIL %s (%s): record %zu differs\n", name, parserName[traceParser], count);
+        return 0;
+      }
+    }
+    pos += used;
+  }
+  if (count != num_expected)
+  {
+    printf("FAIL %s (%s): %zu records, expected %zu\n", name, parserName[traceParser], count, num_expected);
+    return 0;
+  }
+  printf("ok   %s (%s): %zu records\n", name, parserName[traceParser], count);
+  return 1;
+}
+
+// Check every scanner the CPU supports on text[0, size)
+//
+// Returns True if all of them match the reference
+//
+static int check_text(const char *name, const char *text, size_t size)
+{
+  trace_record *expected;
+  size_t num_expected = parse_reference(text, size, &expected);
+  int ok = 1;
+  for (int parser = PARSER_SCALAR; parser <= PARSER_AVX2; parser++)
+  {
+    if (!trace_parser_supported(parser))
+    {
+      printf("skip %s (%s): not supported by this CPU\n", name, parserName[parser]);
+      continue;
+    }
+    traceParser = parser;
+    ok &= check_blocks(name, text, size, expected, num_expected);
+  }
+  free(expected);
+  return ok;
+}
+
+//------------------------------------//
+//               Main                 //
+//------------------------------------//
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: test_trace_parse <trace.bz2>...\n");
+    return 1;
+  }
+
+  char *odd = (char *)calloc(sizeof(oddText) + TRACE_PARSE_PADDING, 1);
+  memcpy(odd, oddText, sizeof(oddText) - 1);
+  int ok = check_text("odd lines", odd, sizeof(oddText) - 1);
+  free(odd);
+  ok &= check_long_line();
+
+  for (int i = 1; i < argc; i++)
+  {
+    size_t size;
+    char *text = read_bz2(argv[i], &size);
+    if (text == NULL)
+    {
+      printf("FAIL %s: unable to read\n", argv[i]);
+      ok = 0;
+      continue;
+    }
+    ok &= check_text(argv[i], text, size);
+    ok &= check_readers(argv[i], argv[i], text, size);
+    free(text);
+  }
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,1370 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Source file for the branch trace readers              //
+//                                                        //
+//  Text traces are parsed a block at a time, binary      //
+//  traces are mmap'd and replayed without any parsing,   //
+//  and bzip2 traces are decoded in the background,       //
+//  block parallel when there are several cores           //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <bzlib.h>
+#include "bzip2_blocks.h"
+#include "trace_codec.h"
+#include "trace.h"
+
+const char *traceFormatName[4] = {"Text", "Binary", "Bzip2", "Codec"};
+
+int traceThreads = 0;
+
+// Size of the ring of parsed records between the bzip2 decoder
+// thread and the simulator (must be a power of two)
+#define RING_RECORDS (1 << 16)
+
+// Sizes of the compressed input and decompressed text buffers
+#define BZ_IN_SIZE (1 << 16)
+#define BZ_OUT_SIZE (1 << 20)
+
+// Size of the text read at once from text traces, and of the
+// batches of records parsed out of text
+#define TEXT_BLOCK (1 << 20)
+#define PARSED_RECORDS (1 << 12)
+
+//------------------------------------//
+//       Trace Data Structures        //
+//------------------------------------//
+
+struct trace_reader
+{
+  int format;
+
+  // position of the last returned record (see trace_index_entry),
+  // maintained when 'track' is set
+  int track;
+  uint64_t pos_offset;
+  uint64_t pos_skip;
+
+  // a record handed back by trace_open_at
+  trace_record pushback;
+  int has_pushback;
+
+  // text traces: 'buf' holds the unparsed text [pos, fill),
+  // 'parsed' the records not yet returned [next_parsed, num_parsed)
+  FILE *stream;
+  char *buf;
+  size_t buf_size;     // TEXT_BLOCK, doubled for longer lines
+  uint64_t buf_offset; // file offset of buf[0]
+  size_t pos;
+  size_t fill;
+  int eof;
+  trace_record *parsed;
+  size_t num_parsed;
+  size_t next_parsed;
+
+  // binary traces
+  void *map;
+  size_t map_size;
+  const trace_record *records;
+  uint64_t num_records;
+  uint64_t next;
+
+  // predictor-coded traces, decoded from the mapped file
+  codec_decoder *codec;
+
+  // bzip2 traces: the decoder thread produces into 'ring' at 'head',
+  // the simulator consumes at 'tail'. Each index is only written by
+  // one side, so the ring needs no locks.
+  FILE *file;
+  pthread_t decoder;
+  int decoder_started;
+  trace_record *ring;
+  char pad0[64];
+  uint64_t head;     // written by the decoder
+  int done;          // decoder finished, 'head' is final
+  char pad1[64];
+  uint64_t tail;     // written by the simulator
+  uint64_t head_seen; // simulator's last copy of 'head'
+  int stop;          // simulator asks the decoder(s) to quit
+
+  // parallel bzip2 traces: 'workers' decode the blocks into 'slots',
+  // the simulator reads slot 'current' and frees it when done
+  const uint8_t *bz_data;
+  size_t bz_size;
+  bz2_block *blocks;
+  long num_blocks;
+  struct block_slot *slots;
+  pthread_t *workers;
+  int num_workers;
+  long window;
+  long next_block;
+  long consumed;
+  pthread_mutex_t lock;        // guards 'consumed' and slot 'ready'
+  pthread_cond_t slot_ready;   // a worker finished a block
+  pthread_cond_t slot_free;    // the simulator released a block
+  long current;
+  long start_block;  // first block, whose head is dropped unless 0
+  int drop_head;
+  char *carry;
+  size_t carry_len;
+  size_t carry_cap;
+  long carry_block;  // block whose tail began the carry, -1 at the start
+  trace_record stitched;
+  int has_stitched;
+  long stitched_block;
+  int head_records;  // records from the head of block 0
+};
+
+struct trace_writer
+{
+  FILE *stream;
+  trace_header header;
+  codec_encoder *codec;
+  int failed;
+};
+
+//------------------------------------//
+//       Text/Binary Functions        //
+//------------------------------------//
+
+int trace_parse_line(const char *line, trace_record *rec)
+{
+  int outcome, condition, call, ret, direct;
+
+  if (sscanf(line, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", &rec->pc, &rec->target,
+             &outcome, &condition, &call, &ret, &direct) != 7)
+  {
+    return 0;
+  }
+
+  rec->flags = (outcome ? BR_OUTCOME : 0) | (condition ? BR_CONDITION : 0) |
+               (call ? BR_CALL : 0) | (ret ? BR_RET : 0) | (direct ? BR_DIRECT : 0);
+  return 1;
+}
+
+// Refill the parsed records of a text trace from its stream
+//
+// Returns True if Successful
+//
+static int text_next(trace_reader *reader, trace_record *rec)
+{
+  if (reader->buf == NULL)
+  {
+    reader->buf_size = TEXT_BLOCK;
+    reader->buf = (char *)malloc(reader->buf_size + 1 + TRACE_PARSE_PADDING);
+    reader->parsed = (trace_record *)malloc(PARSED_RECORDS * sizeof(trace_record));
+  }
+
+  while (reader->next_parsed == reader->num_parsed)
+  {
+    // When tracking, parse one record at a time: it starts somewhere
+    // after the end of the previous one
+    reader->next_parsed = 0;
+    reader->pos_offset = reader->buf_offset + reader->pos;
+    reader->pos += trace_parse_block(reader->buf + reader->pos, reader->fill - reader->pos,
+                                     reader->parsed, reader->track ? 1 : PARSED_RECORDS,
+                                     &reader->num_parsed);
+    if (reader->num_parsed > 0)
+    {
+      break;
+    }
+
+    // Only a partial line is left
+    size_t rest = reader->fill - reader->pos;
+    if (reader->eof)
+    {
+      reader->pos = reader->fill;
+      if (rest == 0)
+      {
+        return 0;
+      }
+      reader->buf[reader->fill] = '\0';
+      if (trace_parse_line(reader->buf + reader->fill - rest, rec))
+      {
+        return 1;
+      }
+      continue;
+    }
+
+    // Grow the buffer for a line that does not fit in it
+    if (rest == reader->buf_size)
+    {
+      reader->buf_size *= 2;
+      reader->buf = (char *)realloc(reader->buf, reader->buf_size + 1 + TRACE_PARSE_PADDING);
+    }
+    memmove(reader->buf, reader->buf + reader->fill - rest, rest);
+    reader->buf_offset += reader->fill - rest;
+    reader->pos = 0;
+    reader->fill = rest;
+
+    size_t n = fread(reader->buf + rest, 1, reader->buf_size - rest, reader->stream);
+    reader->fill += n;
+    reader->eof = (n == 0);
+  }
+
+  *rec = reader->parsed[reader->next_parsed++];
+  return 1;
+}
+
+// Map a binary or predictor-coded trace and validate its header
+//
+// Returns True if Successful
+//
+static int map_binary(trace_reader *reader, int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    return 0;
+  }
+
+  reader->map_size = st.st_size;
+  reader->map = mmap(NULL, reader->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (reader->map == MAP_FAILED)
+  {
+    reader->map = NULL;
+    return 0;
+  }
+  madvise(reader->map, reader->map_size, MADV_SEQUENTIAL);
+
+  const trace_header *header = (const trace_header *)reader->map;
+  if (reader->map_size < sizeof(trace_header))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+
+  if (reader->format == TRACE_CODEC)
+  {
+    if (header->version != CODEC_VERSION)
+    {
+      errno = EINVAL;
+      return 0;
+    }
+    reader->codec = codec_decoder_open((const uint8_t *)(header + 1),
+                                       reader->map_size - sizeof(trace_header), header->num_records);
+    return 1;
+  }
+
+  if (header->version != TRACE_VERSION || header->record_size != sizeof(trace_record) ||
+      header->num_records > (reader->map_size - sizeof(trace_header)) / sizeof(trace_record))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+
+  reader->records = (const trace_record *)(header + 1);
+  reader->num_records = header->num_records;
+  reader->next = 0;
+  return 1;
+}
+
+//------------------------------------//
+//       Bzip2 Decoder Functions      //
+//------------------------------------//
+
+// Append a record to the ring, waiting while it is full
+//
+// Returns False if the simulator asked the decoder to stop
+//
+static int ring_push(trace_reader *reader, const trace_record *rec)
+{
+  uint64_t head = reader->head;
+  while (head - __atomic_load_n(&reader->tail, __ATOMIC_ACQUIRE) == RING_RECORDS)
+  {
+    if (__atomic_load_n(&reader->stop, __ATOMIC_RELAXED))
+    {
+      return 0;
+    }
+    sched_yield();
+  }
+
+  reader->ring[head & (RING_RECORDS - 1)] = *rec;
+  __atomic_store_n(&reader->head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Parse the complete lines in text[0, size) into the ring and move
+// the trailing partial line to the front of 'text'
+//
+// Returns the length of the partial line, or -1 if asked to stop
+//
+static long push_lines(trace_reader *reader, char *text, size_t size)
+{
+  trace_record recs[PARSED_RECORDS];
+  size_t pos = 0;
+
+  while (1)
+  {
+    size_t n;
+    size_t used = trace_parse_block(text + pos, size - pos, recs, PARSED_RECORDS, &n);
+    for (size_t i = 0; i < n; i++)
+    {
+      if (!ring_push(reader, &recs[i]))
+      {
+        return -1;
+      }
+    }
+    pos += used;
+    if (n < PARSED_RECORDS)
+    {
+      break;
+    }
+  }
+
+  size_t rest = size - pos;
+  memmove(text, text + pos, rest);
+  return rest;
+}
+
+// Body of the decoder thread: decompress the (possibly multi-stream)
+// bzip2 file, parse it and feed the records to the simulator
+//
+static void *bzip2_decoder(void *arg)
+{
+  trace_reader *reader = (trace_reader *)arg;
+  char *in = (char *)malloc(BZ_IN_SIZE);
+  size_t out_size = BZ_OUT_SIZE;
+  char *out = (char *)malloc(out_size + 1 + TRACE_PARSE_PADDING);
+  size_t carry = 0;
+  int in_stream = 0;
+  int stopped = 0;
+  int ok = 1;
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  while (ok)
+  {
+    if (strm.avail_in == 0)
+    {
+      size_t n = fread(in, 1, BZ_IN_SIZE, reader->file);
+      if (n == 0)
+      {
+        // Clean end of file only between two streams
+        ok = !in_stream;
+        break;
+      }
+      strm.next_in = in;
+      strm.avail_in = n;
+    }
+
+    if (!in_stream)
+    {
+      char *next_in = strm.next_in;
+      unsigned int avail_in = strm.avail_in;
+      if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK)
+      {
+        ok = 0;
+        break;
+      }
+      strm.next_in = next_in;
+      strm.avail_in = avail_in;
+      in_stream = 1;
+    }
+
+    strm.next_out = out + carry;
+    strm.avail_out = out_size - carry;
+    int ret = BZ2_bzDecompress(&strm);
+    if (ret != BZ_OK && ret != BZ_STREAM_END)
+    {
+      ok = 0;
+      break;
+    }
+
+    long rest = push_lines(reader, out, out_size - strm.avail_out);
+    if (rest < 0)
+    {
+      stopped = 1;
+      break;
+    }
+    carry = rest;
+    // Grow the buffer for a line that does not fit in it
+    if (carry == out_size)
+    {
+      out_size *= 2;
+      out = (char *)realloc(out, out_size + 1 + TRACE_PARSE_PADDING);
+    }
+
+    if (ret == BZ_STREAM_END)
+    {
+      BZ2_bzDecompressEnd(&strm);
+      in_stream = 0;
+    }
+  }
+
+  if (in_stream)
+  {
+    BZ2_bzDecompressEnd(&strm);
+  }
+
+  // A last line without a newline
+  if (ok && !stopped && carry > 0)
+  {
+    trace_record rec;
+    out[carry] = '\0';
+    if (trace_parse_line(out, &rec))
+    {
+      ring_push(reader, &rec);
+    }
+  }
+
+  if (!ok)
+  {
+    fprintf(stderr, "Warning: corrupt or truncated bzip2 trace!\n");
+  }
+
+  free(in);
+  free(out);
+  __atomic_store_n(&reader->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Start decoding a bzip2 trace in the background
+//
+// Returns True if Successful
+//
+static int start_bzip2(trace_reader *reader, int fd)
+{
+  reader->file = fdopen(fd, "rb");
+  if (reader->file == NULL)
+  {
+    return 0;
+  }
+
+  reader->ring = (trace_record *)malloc(RING_RECORDS * sizeof(trace_record));
+  int err = pthread_create(&reader->decoder, NULL, bzip2_decoder, reader);
+  if (err != 0)
+  {
+    errno = err;
+    return 0;
+  }
+  reader->decoder_started = 1;
+  return 1;
+}
+
+// Take the next record from the decoder thread's ring
+//
+// Returns True if Successful
+//
+static int ring_pop(trace_reader *reader, trace_record *rec)
+{
+  uint64_t tail = reader->tail;
+  while (tail == reader->head_seen)
+  {
+    // Read 'done' before 'head' so a final head is never missed
+    int done = __atomic_load_n(&reader->done, __ATOMIC_ACQUIRE);
+    reader->head_seen = __atomic_load_n(&reader->head, __ATOMIC_ACQUIRE);
+    if (tail != reader->head_seen)
+    {
+      break;
+    }
+    if (done)
+    {
+      return 0;
+    }
+    sched_yield();
+  }
+
+  *rec = reader->ring[tail & (RING_RECORDS - 1)];
+  __atomic_store_n(&reader->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+//------------------------------------//
+//    Parallel Bzip2 Block Decoding   //
+//------------------------------------//
+
+// One compressed block and, once 'ready', its decoded records. The
+// lines before the first and after the last newline may continue in
+// the neighbouring blocks and are stitched together by the simulator.
+struct block_slot
+{
+  int ready;
+  int failed;
+  char *text;
+  char *head; // up to the first newline, or all of 'text'
+  char *tail; // after the last newline
+  int has_newline;
+  trace_record *records;
+  size_t num_records;
+};
+
+// Decode block 'i' and parse its complete lines
+//
+static void decode_slot(trace_reader *reader, long i)
+{
+  block_slot *slot = &reader->slots[i];
+  size_t size;
+
+  if (!bz2_decode_block(reader->bz_data, &reader->blocks[i], &slot->text, &size))
+  {
+    slot->failed = 1;
+    return;
+  }
+
+  char *end = slot->text + size;
+  char *first = (char *)memchr(slot->text, '\n', size);
+  slot->head = slot->text;
+  slot->tail = end;
+  slot->has_newline = (first != NULL);
+  if (first == NULL)
+  {
+    return;
+  }
+  *first = '\0';
+
+  // Everything up to the last newline
+  char *line = first + 1;
+  size_t capacity = (end - line) / 16 + 1;
+  slot->records = (trace_record *)malloc(capacity * sizeof(trace_record));
+  while (1)
+  {
+    size_t n;
+    line += trace_parse_block(line, end - line, slot->records + slot->num_records,
+                              capacity - slot->num_records, &n);
+    slot->num_records += n;
+    if (slot->num_records < capacity)
+    {
+      break;
+    }
+    capacity *= 2;
+    slot->records = (trace_record *)realloc(slot->records, capacity * sizeof(trace_record));
+  }
+  slot->tail = line;
+}
+
+// Body of a block decoder thread: take the next undecoded block,
+// staying at most 'window' blocks ahead of the simulator
+//
+static void *block_worker(void *arg)
+{
+  trace_reader *reader = (trace_reader *)arg;
+
+  while (1)
+  {
+    long i = __atomic_fetch_add(&reader->next_block, 1, __ATOMIC_RELAXED);
+    if (i >= reader->num_blocks)
+    {
+      break;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    while (i >= reader->consumed + reader->window && !reader->stop)
+    {
+      pthread_cond_wait(&reader->slot_free, &reader->lock);
+    }
+    int stop = reader->stop;
+    pthread_mutex_unlock(&reader->lock);
+    if (stop)
+    {
+      break;
+    }
+
+    decode_slot(reader, i);
+
+    pthread_mutex_lock(&reader->lock);
+    reader->slots[i].ready = 1;
+    pthread_cond_broadcast(&reader->slot_ready);
+    pthread_mutex_unlock(&reader->lock);
+  }
+  return NULL;
+}
+
+// Map a bzip2 trace, locate its blocks and start 'threads' block
+// decoders at block 'start'
+//
+// Returns False if the trace should be decoded sequentially instead
+//
+static int start_blocks(trace_reader *reader, int fd, int threads, long start)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    return 0;
+  }
+
+  reader->bz_size = st.st_size;
+  void *map = mmap(NULL, reader->bz_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  reader->bz_data = (const uint8_t *)map;
+
+  reader->num_blocks = bz2_find_blocks(reader->bz_data, reader->bz_size, &reader->blocks);
+  if (reader->num_blocks < 1 || start >= reader->num_blocks)
+  {
+    free(reader->blocks);
+    reader->blocks = NULL;
+    munmap(map, reader->bz_size);
+    reader->bz_data = NULL;
+    return 0;
+  }
+
+  reader->slots = (block_slot *)calloc(reader->num_blocks, sizeof(block_slot));
+  reader->window = 4 * threads;
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->slot_ready, NULL);
+  pthread_cond_init(&reader->slot_free, NULL);
+  reader->start_block = start;
+  reader->drop_head = (start > 0);
+  reader->next_block = start;
+  reader->consumed = start;
+  reader->current = start - 1;
+  reader->carry_block = -1;
+  reader->workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; i++)
+  {
+    if (pthread_create(&reader->workers[reader->num_workers], NULL, block_worker, reader) == 0)
+    {
+      reader->num_workers++;
+    }
+  }
+  return reader->num_workers > 0;
+}
+
+// Append 'len' bytes to the partial line carried between blocks
+//
+static void carry_append(trace_reader *reader, const char *text, size_t len)
+{
+  if (reader->carry_len + len + 1 > reader->carry_cap)
+  {
+    reader->carry_cap = 2 * (reader->carry_len + len + 1);
+    reader->carry = (char *)realloc(reader->carry, reader->carry_cap);
+  }
+  memcpy(reader->carry + reader->carry_len, text, len);
+  reader->carry_len += len;
+  reader->carry[reader->carry_len] = '\0';
+}
+
+static void release_slot(trace_reader *reader, long i)
+{
+  free(reader->slots[i].text);
+  free(reader->slots[i].records);
+  reader->slots[i].text = NULL;
+  reader->slots[i].records = NULL;
+
+  pthread_mutex_lock(&reader->lock);
+  reader->consumed = i + 1;
+  pthread_cond_broadcast(&reader->slot_free);
+  pthread_mutex_unlock(&reader->lock);
+}
+
+// Position of a record made of the carried partial line: reading
+// from the block that began it, it comes after all of that block's
+// own records
+//
+static void stitched_position(trace_reader *reader, long block)
+{
+  if (block < 0)
+  {
+    reader->pos_offset = 0;
+    reader->pos_skip = 0;
+    return;
+  }
+  reader->pos_offset = block;
+  reader->pos_skip = reader->slots[block].num_records + (block == 0 ? reader->head_records : 0);
+}
+
+// Take the next record of the block decoders, in trace order
+//
+// Returns True if Successful
+//
+static int blocks_next(trace_reader *reader, trace_record *rec)
+{
+  while (1)
+  {
+    if (reader->has_stitched)
+    {
+      *rec = reader->stitched;
+      reader->has_stitched = 0;
+      stitched_position(reader, reader->stitched_block);
+      return 1;
+    }
+
+    if (reader->current >= reader->start_block && reader->current < reader->num_blocks)
+    {
+      block_slot *slot = &reader->slots[reader->current];
+      if (reader->next < slot->num_records)
+      {
+        reader->pos_offset = reader->current;
+        reader->pos_skip = reader->next + (reader->current == 0 ? reader->head_records : 0);
+        *rec = slot->records[reader->next++];
+        return 1;
+      }
+      release_slot(reader, reader->current);
+    }
+
+    reader->current++;
+    reader->next = 0;
+    if (reader->current >= reader->num_blocks)
+    {
+      reader->current = reader->num_blocks;
+      // A last line without a newline
+      if (reader->carry_len > 0)
+      {
+        reader->carry_len = 0;
+        stitched_position(reader, reader->carry_block);
+        return trace_parse_line(reader->carry, rec);
+      }
+      return 0;
+    }
+
+    block_slot *slot = &reader->slots[reader->current];
+    pthread_mutex_lock(&reader->lock);
+    while (!slot->ready)
+    {
+      pthread_cond_wait(&reader->slot_ready, &reader->lock);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    if (slot->failed)
+    {
+      fprintf(stderr, "Warning: corrupt bzip2 block in trace!\n");
+      reader->current = reader->num_blocks;
+      return 0;
+    }
+
+    if (!slot->has_newline)
+    {
+      if (!reader->drop_head)
+      {
+        carry_append(reader, slot->text, strlen(slot->text));
+      }
+      continue;
+    }
+
+    // The line split across the previous and this block, unless
+    // reading started in the middle of it
+    if (!reader->drop_head)
+    {
+      carry_append(reader, slot->head, strlen(slot->head));
+      if (reader->carry_len > 0)
+      {
+        reader->has_stitched = trace_parse_line(reader->carry, &reader->stitched);
+        reader->stitched_block = reader->carry_block;
+        if (reader->current == 0)
+        {
+          reader->head_records = reader->has_stitched;
+        }
+      }
+    }
+    reader->drop_head = 0;
+    reader->carry_len = 0;
+    reader->carry_block = reader->current;
+    carry_append(reader, slot->tail, strlen(slot->tail));
+  }
+}
+
+//------------------------------------//
+//          Reader Functions          //
+//------------------------------------//
+
+// Open the trace at 'path', positioned at 'at' (a position of an
+// index of a 'at_format' trace) unless NULL. With 'track' set the
+// reader keeps the position of every record for indexing.
+//
+// Returns NULL (with errno set) on failure
+//
+static trace_reader *open_reader(const char *path, const trace_index_entry *at, int at_format, int track)
+{
+  trace_reader *reader = (trace_reader *)calloc(1, sizeof(trace_reader));
+  reader->track = track;
+
+  if (path == NULL || !strcmp(path, "-"))
+  {
+    reader->format = TRACE_TEXT;
+    reader->stream = stdin;
+    return reader;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    free(reader);
+    return NULL;
+  }
+
+  // Detect the format from the leading magic
+  char magic[sizeof(TRACE_MAGIC)] = {0};
+  ssize_t n = read(fd, magic, sizeof(magic));
+  int is_binary = (n == (ssize_t)sizeof(magic) && !memcmp(magic, TRACE_MAGIC, sizeof(magic)));
+  int is_codec = (n == (ssize_t)sizeof(magic) && !memcmp(magic, CODEC_MAGIC, sizeof(magic)));
+  int is_bzip2 = (n >= 4 && !memcmp(magic, "BZh", 3) && magic[3] >= '1' && magic[3] <= '9');
+  lseek(fd, 0, SEEK_SET);
+
+  reader->format = is_binary ? TRACE_BINARY : is_codec ? TRACE_CODEC : is_bzip2 ? TRACE_BZIP2 : TRACE_TEXT;
+  if (at != NULL && (reader->format != at_format || reader->format == TRACE_CODEC))
+  {
+    close(fd);
+    free(reader);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (is_binary || is_codec)
+  {
+    int ok = map_binary(reader, fd);
+    int err = errno;
+    close(fd);
+    if (ok && at != NULL && at->offset > reader->num_records)
+    {
+      ok = 0;
+      err = EINVAL;
+    }
+    if (!ok)
+    {
+      errno = err;
+      trace_close(reader);
+      return NULL;
+    }
+    if (at != NULL)
+    {
+      reader->next = at->offset;
+    }
+    return reader;
+  }
+
+  if (is_bzip2)
+  {
+    // Only the block decoders can start in the middle of the trace
+    // or report positions
+    int threads = (traceThreads > 0) ? traceThreads : sysconf(_SC_NPROCESSORS_ONLN);
+    int seekable = (at != NULL || track);
+    if ((threads > 1 || seekable) && start_blocks(reader, fd, threads > 1 ? threads : 1, at ? at->offset : 0))
+    {
+      close(fd);
+      trace_record rec;
+      for (uint64_t i = 0; at != NULL && i < at->skip && blocks_next(reader, &rec); i++)
+      {
+      }
+      return reader;
+    }
+    if (seekable)
+    {
+      close(fd);
+      trace_close(reader);
+      errno = EINVAL;
+      return NULL;
+    }
+    if (!start_bzip2(reader, fd))
+    {
+      int err = errno;
+      if (reader->file == NULL)
+      {
+        close(fd);
+      }
+      trace_close(reader);
+      errno = err;
+      return NULL;
+    }
+    return reader;
+  }
+
+  reader->stream = fdopen(fd, "r");
+  if (at != NULL)
+  {
+    if (fseeko(reader->stream, at->offset, SEEK_SET) != 0)
+    {
+      int err = errno;
+      trace_close(reader);
+      errno = err;
+      return NULL;
+    }
+    reader->buf_offset = at->offset;
+  }
+  return reader;
+}
+
+trace_reader *trace_open(const char *path)
+{
+  return open_reader(path, NULL, 0, 0);
+}
+
+int trace_next(trace_reader *reader, trace_record *rec)
+{
+  if (reader->has_pushback)
+  {
+    *rec = reader->pushback;
+    reader->has_pushback = 0;
+    return 1;
+  }
+
+  switch (reader->format)
+  {
+  case TRACE_TEXT:
+    return text_next(reader, rec);
+  case TRACE_BINARY:
+    if (reader->next == reader->num_records)
+    {
+      return 0;
+    }
+    *rec = reader->records[reader->next++];
+    return 1;
+  case TRACE_BZIP2:
+    if (reader->num_workers > 0)
+    {
+      return blocks_next(reader, rec);
+    }
+    return ring_pop(reader, rec);
+  case TRACE_CODEC:
+    return codec_decode(reader->codec, rec);
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+static inline void batch_store(trace_batch *batch, size_t i, const trace_record *rec)
+{
+  batch->pc[i] = rec->pc;
+  batch->target[i] = rec->target;
+  batch->flags[i] = rec->flags;
+}
+
+size_t trace_next_batch(trace_reader *reader, trace_batch *batch)
+{
+  size_t n = 0;
+  trace_record rec;
+  if (reader->has_pushback)
+  {
+    batch_store(batch, n++, &reader->pushback);
+    reader->has_pushback = 0;
+  }
+
+  // Binary and parsed text records are copied straight out of the
+  // reader, everything else goes through trace_next
+  switch (reader->format)
+  {
+  case TRACE_BINARY:
+  {
+    size_t avail = reader->num_records - reader->next;
+    if (avail > batch->capacity - n)
+    {
+      avail = batch->capacity - n;
+    }
+    const trace_record *src = reader->records + reader->next;
+    for (size_t i = 0; i < avail; i++)
+    {
+      batch_store(batch, n + i, &src[i]);
+    }
+    n += avail;
+    reader->next += avail;
+    break;
+  }
+  case TRACE_TEXT:
+    while (n < batch->capacity)
+    {
+      size_t avail = reader->num_parsed - reader->next_parsed;
+      if (avail > batch->capacity - n)
+      {
+        avail = batch->capacity - n;
+      }
+      const trace_record *src = reader->parsed + reader->next_parsed;
+      for (size_t i = 0; i < avail; i++)
+      {
+        batch_store(batch, n + i, &src[i]);
+      }
+      n += avail;
+      reader->next_parsed += avail;
+
+      if (n < batch->capacity)
+      {
+        if (!text_next(reader, &rec))
+        {
+          break;
+        }
+        batch_store(batch, n++, &rec);
+      }
+    }
+    break;
+  default:
+    while (n < batch->capacity && trace_next(reader, &rec))
+    {
+      batch_store(batch, n++, &rec);
+    }
+    break;
+  }
+
+  batch->count = n;
+  return n;
+}
+
+void trace_batch_init(trace_batch *batch, size_t capacity)
+{
+  batch->pc = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  batch->target = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  batch->flags = (uint8_t *)malloc(capacity * sizeof(uint8_t));
+  batch->count = 0;
+  batch->capacity = capacity;
+}
+
+void trace_batch_free(trace_batch *batch)
+{
+  free(batch->pc);
+  free(batch->target);
+  free(batch->flags);
+}
+
+int trace_format(trace_reader *reader)
+{
+  return reader->format;
+}
+
+void trace_close(trace_reader *reader)
+{
+  __atomic_store_n(&reader->stop, 1, __ATOMIC_RELAXED);
+  if (reader->decoder_started)
+  {
+    pthread_join(reader->decoder, NULL);
+  }
+  if (reader->num_workers > 0)
+  {
+    pthread_mutex_lock(&reader->lock);
+    pthread_cond_broadcast(&reader->slot_free);
+    pthread_mutex_unlock(&reader->lock);
+    for (int i = 0; i < reader->num_workers; i++)
+    {
+      pthread_join(reader->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->slot_ready);
+    pthread_cond_destroy(&reader->slot_free);
+  }
+  for (long i = 0; reader->slots != NULL && i < reader->num_blocks; i++)
+  {
+    free(reader->slots[i].text);
+    free(reader->slots[i].records);
+  }
+  free(reader->slots);
+  free(reader->workers);
+  free(reader->blocks);
+  free(reader->carry);
+  if (reader->bz_data != NULL)
+  {
+    munmap((void *)reader->bz_data, reader->bz_size);
+  }
+  if (reader->file != NULL)
+  {
+    fclose(reader->file);
+  }
+  free(reader->ring);
+  if (reader->stream != NULL && reader->stream != stdin)
+  {
+    fclose(reader->stream);
+  }
+  if (reader->codec != NULL)
+  {
+    codec_decoder_close(reader->codec);
+  }
+  if (reader->map != NULL)
+  {
+    munmap(reader->map, reader->map_size);
+  }
+  free(reader->buf);
+  free(reader->parsed);
+  free(reader);
+}
+
+//------------------------------------//
+//          Index Functions           //
+//------------------------------------//
+
+char *trace_index_path(const char *path)
+{
+  // Appended to the whole name, so that traces differing only in
+  // their extension keep indexes of their own
+  size_t len = strlen(path);
+  char *index = (char *)malloc(len + sizeof(".idx"));
+  memcpy(index, path, len);
+  strcpy(index + len, ".idx");
+  return index;
+}
+
+// Find the last entry of the index of 'path' at or before the
+// 'skip'-th conditional branch
+//
+// Returns True if there is a valid index
+//
+static int find_index_entry(const char *path, uint64_t skip, int *format, trace_index_entry *entry)
+{
+  struct stat st;
+  if (stat(path, &st) != 0)
+  {
+    return 0;
+  }
+
+  char *index_path = trace_index_path(path);
+  FILE *stream = fopen(index_path, "rb");
+  free(index_path);
+  if (stream == NULL)
+  {
+    return 0;
+  }
+
+  trace_index_header header;
+  int ok = (fread(&header, sizeof(header), 1, stream) == 1 &&
+            !memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) &&
+            header.version == INDEX_VERSION &&
+            header.source_size == (uint64_t)st.st_size &&
+            header.num_entries > 0);
+
+  trace_index_entry *entries = NULL;
+  if (ok)
+  {
+    entries = (trace_index_entry *)malloc(header.num_entries * sizeof(trace_index_entry));
+    ok = (fread(entries, sizeof(trace_index_entry), header.num_entries, stream) == header.num_entries);
+  }
+  fclose(stream);
+
+  if (ok)
+  {
+    // Entries are in trace order
+    uint64_t lo = 0, hi = header.num_entries;
+    while (hi - lo > 1)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (entries[mid].cond <= skip)
+      {
+        lo = mid;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    *entry = entries[lo];
+    *format = header.format;
+    ok = (entry->cond <= skip);
+  }
+  free(entries);
+  return ok;
+}
+
+trace_reader *trace_open_at(const char *path, uint64_t skip)
+{
+  if (skip == 0)
+  {
+    return trace_open(path);
+  }
+
+  trace_index_entry entry;
+  int format;
+  trace_reader *reader = NULL;
+  uint64_t cond = 0;
+  if (path != NULL && strcmp(path, "-") && find_index_entry(path, skip, &format, &entry))
+  {
+    reader = open_reader(path, &entry, format, 0);
+    cond = entry.cond;
+  }
+  if (reader == NULL)
+  {
+    reader = trace_open(path);
+    cond = 0;
+  }
+  if (reader == NULL)
+  {
+    return NULL;
+  }
+
+  // Read up to the conditional branch and leave it to trace_next
+  trace_record rec;
+  while (trace_next(reader, &rec))
+  {
+    if (rec.flags & BR_CONDITION)
+    {
+      if (cond == skip)
+      {
+        reader->pushback = rec;
+        reader->has_pushback = 1;
+        break;
+      }
+      cond++;
+    }
+  }
+  return reader;
+}
+
+int trace_build_index(const char *path, uint64_t interval)
+{
+  struct stat st;
+  if (interval == 0 || stat(path, &st) != 0)
+  {
+    errno = (interval == 0) ? EINVAL : errno;
+    return 0;
+  }
+
+  trace_reader *reader = open_reader(path, NULL, 0, 1);
+  if (reader == NULL)
+  {
+    return 0;
+  }
+  if (reader->format == TRACE_CODEC)
+  {
+    trace_close(reader);
+    errno = ENOTSUP;
+    return 0;
+  }
+
+  uint64_t capacity = 1024, num_entries = 0;
+  trace_index_entry *entries = (trace_index_entry *)malloc(capacity * sizeof(trace_index_entry));
+  uint64_t cond = 0, record = 0;
+  trace_record rec;
+  while (trace_next(reader, &rec))
+  {
+    if ((rec.flags & BR_CONDITION) && cond++ % interval == 0)
+    {
+      if (num_entries == capacity)
+      {
+        capacity *= 2;
+        entries = (trace_index_entry *)realloc(entries, capacity * sizeof(trace_index_entry));
+      }
+      trace_index_entry *entry = &entries[num_entries++];
+      entry->cond = cond - 1;
+      entry->record = record;
+      if (reader->format == TRACE_BINARY)
+      {
+        entry->offset = record;
+        entry->skip = 0;
+      }
+      else
+      {
+        entry->offset = reader->pos_offset;
+        entry->skip = reader->pos_skip;
+      }
+    }
+    record++;
+  }
+  int format = reader->format;
+  trace_close(reader);
+
+  trace_index_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.version = INDEX_VERSION;
+  header.format = format;
+  header.source_size = st.st_size;
+  header.interval = interval;
+  header.num_entries = num_entries;
+
+  // Written under a temporary name so that concurrent runs never
+  // read half an index
+  char *index_path = trace_index_path(path);
+  size_t len = strlen(index_path) + 32;
+  char *tmp = (char *)malloc(len);
+  snprintf(tmp, len, "%s.%d.tmp", index_path, (int)getpid());
+  FILE *stream = fopen(tmp, "wb");
+  int ok = (stream != NULL);
+  if (ok)
+  {
+    ok = (fwrite(&header, sizeof(header), 1, stream) == 1 &&
+          fwrite(entries, sizeof(trace_index_entry), num_entries, stream) == num_entries);
+    ok = (fclose(stream) == 0) && ok;
+    ok = ok && (rename(tmp, index_path) == 0);
+    if (!ok)
+    {
+      remove(tmp);
+    }
+  }
+  free(tmp);
+  free(index_path);
+  free(entries);
+  return ok;
+}
+
+//------------------------------------//
+//          Writer Functions          //
+//------------------------------------//
+
+trace_writer *trace_writer_open(const char *path, int format)
+{
+  if (format != TRACE_BINARY && format != TRACE_CODEC)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  FILE *stream = fopen(path, "wb");
+  if (stream == NULL)
+  {
+    return NULL;
+  }
+
+  trace_writer *writer = (trace_writer *)calloc(1, sizeof(trace_writer));
+  writer->stream = stream;
+  if (format == TRACE_CODEC)
+  {
+    memcpy(writer->header.magic, CODEC_MAGIC, sizeof(CODEC_MAGIC));
+    writer->header.version = CODEC_VERSION;
+  }
+  else
+  {
+    memcpy(writer->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    writer->header.version = TRACE_VERSION;
+    writer->header.record_size = sizeof(trace_record);
+  }
+  writer->header.num_records = 0;
+
+  // Placeholder header, rewritten once the record count is known
+  if (fwrite(&writer->header, sizeof(trace_header), 1, stream) != 1)
+  {
+    writer->failed = 1;
+  }
+  if (format == TRACE_CODEC)
+  {
+    writer->codec = codec_encoder_open(stream);
+  }
+  return writer;
+}
+
+int trace_write(trace_writer *writer, const trace_record *rec)
+{
+  if (writer->codec != NULL)
+  {
+    if (!codec_encode(writer->codec, rec))
+    {
+      writer->failed = 1;
+      return 0;
+    }
+    writer->header.num_records++;
+    return 1;
+  }
+
+  if (fwrite(rec, sizeof(trace_record), 1, writer->stream) != 1)
+  {
+    writer->failed = 1;
+    return 0;
+  }
+  writer->header.num_records++;
+  return 1;
+}
+
+int trace_writer_close(trace_writer *writer)
+{
+  int ok = !writer->failed;
+
+  if (writer->codec != NULL && !codec_encoder_close(writer->codec))
+  {
+    ok = 0;
+  }
+  if (fseek(writer->stream, 0, SEEK_SET) != 0 ||
+      fwrite(&writer->header, sizeof(trace_header), 1, writer->stream) != 1)
+  {
+    ok = 0;
+  }
+  if (fclose(writer->stream) != 0)
+  {
+    ok = 0;
+  }
+  free(writer);
+  return ok;
+}
@@ -0,0 +1,202 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the branch trace readers              //
+//                                                        //
+//  Includes the packed binary trace format and the       //
+//  reader/writer interface used by the simulator         //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+//------------------------------------//
+//        Trace Record Defines        //
+//------------------------------------//
+
+// Bits of the flags byte of a branch record
+#define BR_OUTCOME 0x01   // branch was taken
+#define BR_CONDITION 0x02 // conditional branch
+#define BR_CALL 0x04      // call instruction
+#define BR_RET 0x08       // return instruction
+#define BR_DIRECT 0x10    // direct branch
+
+// One branch of the trace, stored as-is in the binary format
+//
+typedef struct __attribute__((packed))
+{
+  uint32_t pc;
+  uint32_t target;
+  uint8_t flags;
+} trace_record;
+
+// Header at the start of a binary trace file, followed by
+// 'num_records' packed trace_records
+//
+#define TRACE_MAGIC "BPTRACE"
+#define TRACE_VERSION 1
+
+typedef struct
+{
+  char magic[8];        // TRACE_MAGIC, zero padded
+  uint32_t version;     // TRACE_VERSION
+  uint32_t record_size; // sizeof(trace_record)
+  uint64_t num_records;
+} trace_header;
+
+// The Different Trace Formats
+#define TRACE_TEXT 0   // tab separated text lines
+#define TRACE_BINARY 1 // trace_header + packed records
+#define TRACE_BZIP2 2  // bzip2 compressed text
+#define TRACE_CODEC 3  // trace_header + predictor-coded records
+extern const char *traceFormatName[];
+
+// A sidecar index (the trace path with .idx appended) lists,
+// every 'interval' conditional branches, where reading the trace
+// can resume. It is only trusted while the trace keeps its size.
+//
+#define INDEX_MAGIC "BPINDEX"
+#define INDEX_VERSION 1
+#define INDEX_INTERVAL 100000
+
+typedef struct
+{
+  char magic[8];        // INDEX_MAGIC, zero padded
+  uint32_t version;     // INDEX_VERSION
+  uint32_t format;      // format of the indexed trace
+  uint64_t source_size; // size of the indexed trace
+  uint64_t interval;
+  uint64_t num_entries;
+} trace_index_header;
+
+typedef struct
+{
+  uint64_t cond;   // conditional branches before this record
+  uint64_t record; // records before this record
+  uint64_t offset; // text: byte offset, binary: record, bzip2: block
+  uint64_t skip;   // records to drop after seeking to 'offset'
+} trace_index_entry;
+
+// A block of consecutive records stored as separate arrays, so that
+// consumers stream through only the fields they need
+//
+#define TRACE_BATCH_SIZE 4096
+
+typedef struct
+{
+  uint32_t *pc;
+  uint32_t *target;
+  uint8_t *flags; // BR_* bits
+  size_t count;
+  size_t capacity;
+} trace_batch;
+
+// Delimiter scanner used by trace_parse_block; -1 (or one the CPU
+// does not support) picks the widest one it supports
+#define PARSER_SCALAR 0
+#define PARSER_SSE2 1
+#define PARSER_AVX2 2
+extern int traceParser;
+
+// Returns True if the CPU supports delimiter scanner 'parser'
+//
+int trace_parser_supported(int parser);
+
+// Readable bytes required after a text block handed to
+// trace_parse_block, which scans 64 bytes at a time
+#define TRACE_PARSE_PADDING 64
+
+// Number of threads decoding a bzip2 trace; 0 uses one per core.
+// With more than one, independent bzip2 blocks are decoded in
+// parallel, otherwise a single background thread streams the trace.
+extern int traceThreads;
+
+//------------------------------------//
+//      Trace Function Prototypes     //
+//------------------------------------//
+
+typedef struct trace_reader trace_reader;
+typedef struct trace_writer trace_writer;
+
+// Open the trace at 'path' ("-" or NULL reads text from stdin).
+// The format is detected from the file contents; bzip2 traces
+// are decompressed and parsed in the background (see traceThreads).
+//
+// Returns NULL (with errno set) on failure
+//
+trace_reader *trace_open(const char *path);
+
+// Reads the next branch of the trace into 'rec'
+//
+// Returns True if Successful
+//
+int trace_next(trace_reader *reader, trace_record *rec);
+
+// Reads up to batch->capacity next branches of the trace into 'batch'
+//
+// Returns the number of branches read, 0 at the end of the trace
+//
+size_t trace_next_batch(trace_reader *reader, trace_batch *batch);
+
+void trace_batch_init(trace_batch *batch, size_t capacity);
+
+void trace_batch_free(trace_batch *batch);
+
+// Format of an opened trace
+//
+int trace_format(trace_reader *reader);
+
+void trace_close(trace_reader *reader);
+
+// Open the trace at 'path' positioned at its 'skip'-th conditional
+// branch, seeking through its index when there is a valid one and
+// reading up to that branch otherwise
+//
+// Returns NULL (with errno set) on failure
+//
+trace_reader *trace_open_at(const char *path, uint64_t skip);
+
+// Path of the index of the trace at 'path' (malloc'd)
+//
+char *trace_index_path(const char *path);
+
+// Write the index of the trace at 'path' with an entry every
+// 'interval' conditional branches. Codec traces cannot be indexed.
+//
+// Returns True if Successful
+//
+int trace_build_index(const char *path, uint64_t interval);
+
+// Parse one text trace line into 'rec' with sscanf. This is the
+// reference parser, also used for lines trace_parse_block does not
+// recognize.
+//
+// Returns True if Successful
+//
+int trace_parse_line(const char *line, trace_record *rec);
+
+// Parse the complete lines of text[0, size) into at most
+// 'max_records' records. 'text' must be followed by
+// TRACE_PARSE_PADDING readable bytes.
+//
+// Returns the number of bytes consumed (up to the last parsed newline)
+//
+size_t trace_parse_block(const char *text, size_t size, trace_record *records,
+                         size_t max_records, size_t *num_records);
+
+// Create a TRACE_BINARY or TRACE_CODEC trace at 'path'. The
+// header is finalized by trace_writer_close.
+//
+// Returns NULL (with errno set) on failure
+//
+trace_writer *trace_writer_open(const char *path, int format);
+
+int trace_write(trace_writer *writer, const trace_record *rec);
+
+// Returns True if the whole trace was written successfully
+//
+int trace_writer_close(trace_writer *writer);
+
+#endif
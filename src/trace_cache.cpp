@@ -0,0 +1,276 @@
+//========================================================//
+//  trace_cache.cpp                                       //
+//  Source file for the decoded-trace cache               //
+//                                                        //
+//  A cached trace is <key>.bpt (plus its <key>.bpt.idx   //
+//  index) where the key hashes the source contents, so   //
+//  renamed or copied traces still hit the cache          //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "trace_cache.h"
+
+//------------------------------------//
+//           Cache Helpers            //
+//------------------------------------//
+
+// Hash the contents of the file at 'path' a word at a time
+//
+// Returns True if Successful
+//
+static int hash_file(const char *path, uint64_t *key)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+  uint64_t size = st.st_size;
+  uint64_t h = size * 0x9E3779B97F4A7C15ULL;
+  if (size > 0)
+  {
+    const uint8_t *data = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      return 0;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    uint64_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+      uint64_t w;
+      memcpy(&w, data + i, 8);
+      h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 32;
+    }
+    for (; i < size; i++)
+    {
+      h = (h ^ data[i]) * 0x100000001B3ULL;
+    }
+    munmap((void *)data, size);
+  }
+  close(fd);
+
+  *key = h ^ (h >> 29);
+  return 1;
+}
+
+// Returns True if the file at 'path' already is a binary trace
+//
+static int is_binary_trace(const char *path)
+{
+  char magic[sizeof(TRACE_MAGIC)] = {0};
+  FILE *stream = fopen(path, "rb");
+  if (stream == NULL)
+  {
+    return 0;
+  }
+  size_t n = fread(magic, 1, sizeof(magic), stream);
+  fclose(stream);
+  return n == sizeof(magic) && !memcmp(magic, TRACE_MAGIC, sizeof(magic));
+}
+
+// Decode the trace at 'path' into the binary trace 'cached' (and
+// its index). The copy is written under a temporary name and
+// renamed when complete, so concurrent runs never see half a trace.
+//
+// Returns True if Successful
+//
+static int fill_cache(const char *path, const char *cached)
+{
+  trace_reader *reader = trace_open(path);
+  if (reader == NULL)
+  {
+    return 0;
+  }
+
+  size_t len = strlen(cached) + 32;
+  char *tmp = (char *)malloc(len);
+  snprintf(tmp, len, "%s.%d.tmp", cached, (int)getpid());
+  trace_writer *writer = trace_writer_open(tmp, TRACE_BINARY);
+  if (writer == NULL)
+  {
+    int err = errno;
+    trace_close(reader);
+    free(tmp);
+    errno = err;
+    return 0;
+  }
+
+  int ok = 1;
+  trace_record rec;
+  while (ok && trace_next(reader, &rec))
+  {
+    ok = trace_write(writer, &rec);
+  }
+  trace_close(reader);
+  ok = trace_writer_close(writer) && ok;
+
+  int err = errno;
+  if (ok && rename(tmp, cached) != 0)
+  {
+    err = errno;
+    ok = 0;
+  }
+  if (!ok)
+  {
+    remove(tmp);
+  }
+  free(tmp);
+
+  if (ok)
+  {
+    // Without an index --skip still works, only slower
+    trace_build_index(cached, INDEX_INTERVAL);
+  }
+  errno = err;
+  return ok;
+}
+
+typedef struct
+{
+  char *name; // file name without the .bpt extension
+  time_t used;
+  uint64_t size;
+} cache_entry;
+
+static int compare_used(const void *a, const void *b)
+{
+  time_t x = ((const cache_entry *)a)->used;
+  time_t y = ((const cache_entry *)b)->used;
+  return (x > y) - (x < y);
+}
+
+// Remove the least recently used traces of 'dir' until it holds at
+// most 'cap' bytes, never removing the trace named 'keep'
+//
+static void evict_cache(const char *dir, uint64_t cap, const char *keep)
+{
+  DIR *d = opendir(dir);
+  if (d == NULL)
+  {
+    return;
+  }
+
+  int capacity = 16, count = 0;
+  cache_entry *entries = (cache_entry *)malloc(capacity * sizeof(cache_entry));
+  uint64_t total = 0;
+  size_t dir_len = strlen(dir);
+  char *path = (char *)malloc(dir_len + 256 + 8);
+
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL)
+  {
+    size_t len = strlen(ent->d_name);
+    if (len < 5 || strcmp(ent->d_name + len - 4, ".bpt") != 0 || len > 255)
+    {
+      continue;
+    }
+
+    // A trace and its index count together, used as of the trace
+    struct stat st;
+    sprintf(path, "%s/%s", dir, ent->d_name);
+    if (stat(path, &st) != 0)
+    {
+      continue;
+    }
+    if (count == capacity)
+    {
+      capacity *= 2;
+      entries = (cache_entry *)realloc(entries, capacity * sizeof(cache_entry));
+    }
+    cache_entry *entry = &entries[count++];
+    entry->name = strndup(ent->d_name, len - 4);
+    entry->used = st.st_mtime;
+    entry->size = st.st_size;
+    sprintf(path, "%s/%s.bpt.idx", dir, entry->name);
+    if (stat(path, &st) == 0)
+    {
+      entry->size += st.st_size;
+    }
+    total += entry->size;
+  }
+  closedir(d);
+
+  qsort(entries, count, sizeof(cache_entry), compare_used);
+  for (int i = 0; i < count && total > cap; i++)
+  {
+    if (strcmp(entries[i].name, keep) != 0)
+    {
+      sprintf(path, "%s/%s.bpt", dir, entries[i].name);
+      remove(path);
+      sprintf(path, "%s/%s.bpt.idx", dir, entries[i].name);
+      remove(path);
+      total -= entries[i].size;
+    }
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    free(entries[i].name);
+  }
+  free(entries);
+  free(path);
+}
+
+//------------------------------------//
+//           Cache Functions          //
+//------------------------------------//
+
+trace_reader *trace_cache_open(const char *path, uint64_t skip)
+{
+  const char *dir = getenv(TRACE_CACHE_ENV);
+  uint64_t key;
+  if (dir == NULL || dir[0] == '\0' || path == NULL || !strcmp(path, "-") ||
+      is_binary_trace(path) || !hash_file(path, &key))
+  {
+    return trace_open_at(path, skip);
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+  size_t len = strlen(dir) + sizeof(name) + 8;
+  char *cached = (char *)malloc(len);
+  snprintf(cached, len, "%s/%s.bpt", dir, name);
+
+  // Hits are marked as recently used by their modification time
+  if (utimes(cached, NULL) != 0)
+  {
+    mkdir(dir, 0777);
+    if (!fill_cache(path, cached))
+    {
+      fprintf(stderr, "Warning: unable to cache trace in %s: %s\n", dir, strerror(errno));
+      free(cached);
+      return trace_open_at(path, skip);
+    }
+
+    const char *size = getenv(TRACE_CACHE_SIZE_ENV);
+    uint64_t cap = (size != NULL) ? strtoull(size, NULL, 0) : TRACE_CACHE_SIZE;
+    evict_cache(dir, cap << 20, name);
+  }
+
+  trace_reader *reader = trace_open_at(cached, skip);
+  free(cached);
+  if (reader == NULL)
+  {
+    return trace_open_at(path, skip);
+  }
+  return reader;
+}
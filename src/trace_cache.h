@@ -0,0 +1,31 @@
+//========================================================//
+//  trace_cache.h                                         //
+//  Header file for the decoded-trace cache               //
+//                                                        //
+//  Traces are decoded once into binary traces kept in    //
+//  the $BP_TRACE_CACHE directory, named after a hash of  //
+//  the source file, and mmap'd by later runs             //
+//========================================================//
+
+#ifndef TRACE_CACHE_H
+#define TRACE_CACHE_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Environment variables naming the cache directory and its size
+// cap in MB (default TRACE_CACHE_SIZE)
+#define TRACE_CACHE_ENV "BP_TRACE_CACHE"
+#define TRACE_CACHE_SIZE_ENV "BP_TRACE_CACHE_SIZE"
+#define TRACE_CACHE_SIZE 4096
+
+// Open the trace at 'path' like trace_open_at. With $BP_TRACE_CACHE
+// set, text, bzip2 and codec traces are read from their cached
+// binary copy, which is created on first use. The least recently
+// used copies are evicted to keep the cache under its size cap.
+//
+// Returns NULL (with errno set) on failure
+//
+trace_reader *trace_cache_open(const char *path, uint64_t skip);
+
+#endif
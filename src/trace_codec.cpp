@@ -0,0 +1,589 @@
+//========================================================//
+//  trace_codec.cpp                                       //
+//  Source file for the predictor-coded trace format      //
+//                                                        //
+//  The encoder and decoder run the same trace model:     //
+//  a dictionary of static branches (flags, last target), //
+//  the branch that last followed each landing address,   //
+//  a return stack and a reference gshare predictor.      //
+//  Each record becomes a few hit/miss bits against the   //
+//  model, coded with an adaptive binary range coder      //
+//========================================================//
+#include <stdlib.h>
+#include <string.h>
+#include "trace_codec.h"
+
+// Reference gshare, successor table and return stack of the model
+#define CODEC_GSHARE_BITS 16
+#define CODEC_LANDING_BITS 18
+#define CODEC_RAS_DEPTH 64
+
+// Largest distance from a call to its return address coded compactly
+#define RET_DELTA_BITS 4
+
+// Binary range coder parameters (probabilities are 11-bit)
+#define PROB_BITS 11
+#define PROB_INIT (1 << (PROB_BITS - 1))
+#define PROB_SHIFT 5
+#define RANGE_TOP (1U << 24)
+
+#define NO_ID 0xFFFFFFFF
+
+// Flags that are a property of the static branch, not of one execution
+#define STATIC_FLAGS (BR_CONDITION | BR_CALL | BR_RET | BR_DIRECT)
+
+//------------------------------------//
+//          Trace Model               //
+//------------------------------------//
+
+typedef struct
+{
+  // dictionary of static branches, indexed by id
+  uint32_t *pcs;
+  uint8_t *static_flags;
+  uint8_t *last_outcome;
+  uint32_t *last_target;
+  uint16_t *p_target; // probability the target repeats
+  uint32_t num_ids;
+  uint32_t capacity;
+
+  // open addressing pc -> id + 1
+  uint32_t *hash;
+  uint32_t hash_mask;
+
+  // reference gshare
+  uint8_t *bht;
+  uint32_t ghistory;
+
+  // branch that last followed each landing address (target of a
+  // taken branch, pc of a not-taken one), direct mapped
+  uint32_t *landing;
+  uint32_t *landing_id; // id + 1
+  uint16_t *p_landing;  // probability the successor repeats
+  uint32_t prev_landing;
+  int have_prev;
+
+  // return address stack of call pcs
+  uint32_t ras[CODEC_RAS_DEPTH];
+  uint32_t ras_size;
+
+  // adaptive probabilities of the coded bits
+  uint16_t p_known;
+  uint16_t p_ras;
+  uint16_t p_flags_same;
+  uint16_t p_outcome[8];
+} codec_model;
+
+static void model_init(codec_model *m)
+{
+  memset(m, 0, sizeof(*m));
+  m->capacity = 1024;
+  m->pcs = (uint32_t *)malloc(m->capacity * sizeof(uint32_t));
+  m->static_flags = (uint8_t *)malloc(m->capacity);
+  m->last_outcome = (uint8_t *)malloc(m->capacity);
+  m->last_target = (uint32_t *)malloc(m->capacity * sizeof(uint32_t));
+  m->p_target = (uint16_t *)malloc(m->capacity * sizeof(uint16_t));
+  m->hash_mask = 2 * m->capacity - 1;
+  m->hash = (uint32_t *)calloc(m->hash_mask + 1, sizeof(uint32_t));
+
+  m->bht = (uint8_t *)malloc(1 << CODEC_GSHARE_BITS);
+  memset(m->bht, 1, 1 << CODEC_GSHARE_BITS); // weakly not taken
+
+  m->landing = (uint32_t *)calloc(1 << CODEC_LANDING_BITS, sizeof(uint32_t));
+  m->landing_id = (uint32_t *)calloc(1 << CODEC_LANDING_BITS, sizeof(uint32_t));
+  m->p_landing = (uint16_t *)malloc((1 << CODEC_LANDING_BITS) * sizeof(uint16_t));
+  for (int i = 0; i < (1 << CODEC_LANDING_BITS); i++)
+  {
+    m->p_landing[i] = PROB_INIT;
+  }
+
+  m->p_known = PROB_INIT;
+  m->p_ras = PROB_INIT;
+  m->p_flags_same = PROB_INIT;
+  for (int i = 0; i < 8; i++)
+  {
+    m->p_outcome[i] = PROB_INIT;
+  }
+}
+
+static void model_free(codec_model *m)
+{
+  free(m->pcs);
+  free(m->static_flags);
+  free(m->last_outcome);
+  free(m->last_target);
+  free(m->p_target);
+  free(m->hash);
+  free(m->bht);
+  free(m->landing);
+  free(m->landing_id);
+  free(m->p_landing);
+}
+
+static inline uint32_t hash_pc(uint32_t pc)
+{
+  return (pc * 0x9E3779B1U) >> 7;
+}
+
+static uint32_t model_lookup(const codec_model *m, uint32_t pc)
+{
+  for (uint32_t h = hash_pc(pc) & m->hash_mask; m->hash[h] != 0; h = (h + 1) & m->hash_mask)
+  {
+    if (m->pcs[m->hash[h] - 1] == pc)
+    {
+      return m->hash[h] - 1;
+    }
+  }
+  return NO_ID;
+}
+
+static uint32_t model_add(codec_model *m, uint32_t pc, uint8_t static_flags)
+{
+  if (m->num_ids == m->capacity)
+  {
+    m->capacity *= 2;
+    m->pcs = (uint32_t *)realloc(m->pcs, m->capacity * sizeof(uint32_t));
+    m->static_flags = (uint8_t *)realloc(m->static_flags, m->capacity);
+    m->last_outcome = (uint8_t *)realloc(m->last_outcome, m->capacity);
+    m->last_target = (uint32_t *)realloc(m->last_target, m->capacity * sizeof(uint32_t));
+    m->p_target = (uint16_t *)realloc(m->p_target, m->capacity * sizeof(uint16_t));
+
+    // Keep the hash table at most half full
+    free(m->hash);
+    m->hash_mask = 2 * m->capacity - 1;
+    m->hash = (uint32_t *)calloc(m->hash_mask + 1, sizeof(uint32_t));
+    for (uint32_t id = 0; id < m->num_ids; id++)
+    {
+      uint32_t h = hash_pc(m->pcs[id]) & m->hash_mask;
+      while (m->hash[h] != 0)
+      {
+        h = (h + 1) & m->hash_mask;
+      }
+      m->hash[h] = id + 1;
+    }
+  }
+
+  uint32_t id = m->num_ids++;
+  m->pcs[id] = pc;
+  m->static_flags[id] = static_flags;
+  m->last_outcome[id] = 0;
+  m->last_target[id] = 0;
+  m->p_target[id] = PROB_INIT;
+
+  uint32_t h = hash_pc(pc) & m->hash_mask;
+  while (m->hash[h] != 0)
+  {
+    h = (h + 1) & m->hash_mask;
+  }
+  m->hash[h] = id + 1;
+  return id;
+}
+
+// Slot of the successor table for the previous landing address
+//
+static inline uint32_t landing_slot(const codec_model *m)
+{
+  return hash_pc(m->prev_landing) & ((1 << CODEC_LANDING_BITS) - 1);
+}
+
+// Branch the model expects next, or NO_ID if it has no guess
+//
+static inline uint32_t model_predicted_id(const codec_model *m)
+{
+  uint32_t slot = landing_slot(m);
+  if (!m->have_prev || m->landing[slot] != m->prev_landing)
+  {
+    return NO_ID;
+  }
+  return m->landing_id[slot] - 1;
+}
+
+// Bits needed to code any existing id
+//
+static inline int id_bits(const codec_model *m)
+{
+  return m->num_ids <= 1 ? 1 : 32 - __builtin_clz(m->num_ids - 1);
+}
+
+// Outcome the model expects for branch 'id', and the context its
+// hit/miss bit is coded in
+//
+static inline uint32_t model_predict_outcome(const codec_model *m, uint32_t id, int *ctx)
+{
+  if (m->static_flags[id] & BR_CONDITION)
+  {
+    uint8_t counter = m->bht[(m->pcs[id] ^ m->ghistory) & ((1 << CODEC_GSHARE_BITS) - 1)];
+    *ctx = counter;
+    return counter >= 2;
+  }
+  *ctx = 4 + m->last_outcome[id];
+  return m->last_outcome[id];
+}
+
+// Move the model past a record of branch 'id'
+//
+static inline void model_update(codec_model *m, uint32_t id, uint32_t outcome, uint32_t target)
+{
+  if (m->static_flags[id] & BR_CONDITION)
+  {
+    uint8_t *counter = &m->bht[(m->pcs[id] ^ m->ghistory) & ((1 << CODEC_GSHARE_BITS) - 1)];
+    if (outcome && *counter < 3)
+    {
+      (*counter)++;
+    }
+    else if (!outcome && *counter > 0)
+    {
+      (*counter)--;
+    }
+    m->ghistory = (m->ghistory << 1) | outcome;
+  }
+
+  m->last_outcome[id] = outcome;
+  m->last_target[id] = target;
+
+  if (m->have_prev)
+  {
+    uint32_t slot = landing_slot(m);
+    m->landing[slot] = m->prev_landing;
+    m->landing_id[slot] = id + 1;
+  }
+  m->prev_landing = outcome ? target : m->pcs[id];
+  m->have_prev = 1;
+
+  if (m->static_flags[id] & BR_CALL)
+  {
+    m->ras[m->ras_size++ % CODEC_RAS_DEPTH] = m->pcs[id];
+  }
+  else if ((m->static_flags[id] & BR_RET) && m->ras_size > 0)
+  {
+    m->ras_size--;
+  }
+}
+
+// Call pc a return is expected to go back to
+//
+static inline uint32_t model_ras_top(const codec_model *m)
+{
+  return m->ras_size > 0 ? m->ras[(m->ras_size - 1) % CODEC_RAS_DEPTH] : 0;
+}
+
+//------------------------------------//
+//         Range Encoder              //
+//------------------------------------//
+
+struct codec_encoder
+{
+  FILE *stream;
+  uint64_t low;
+  uint32_t range;
+  uint8_t cache;
+  uint64_t cache_size;
+  uint8_t out[1 << 16];
+  size_t out_len;
+  int failed;
+  codec_model model;
+};
+
+static void put_byte(codec_encoder *enc, uint8_t byte)
+{
+  enc->out[enc->out_len++] = byte;
+  if (enc->out_len == sizeof(enc->out))
+  {
+    if (fwrite(enc->out, 1, enc->out_len, enc->stream) != enc->out_len)
+    {
+      enc->failed = 1;
+    }
+    enc->out_len = 0;
+  }
+}
+
+static void shift_low(codec_encoder *enc)
+{
+  if ((uint32_t)enc->low < 0xFF000000U || (enc->low >> 32) != 0)
+  {
+    uint8_t carry = (uint8_t)(enc->low >> 32);
+    uint8_t temp = enc->cache;
+    do
+    {
+      put_byte(enc, temp + carry);
+      temp = 0xFF;
+    } while (--enc->cache_size != 0);
+    enc->cache = (uint8_t)(enc->low >> 24);
+  }
+  enc->cache_size++;
+  enc->low = (enc->low & 0x00FFFFFF) << 8;
+}
+
+static void encode_bit(codec_encoder *enc, uint16_t *prob, uint32_t bit)
+{
+  uint32_t bound = (enc->range >> PROB_BITS) * *prob;
+  if (bit == 0)
+  {
+    enc->range = bound;
+    *prob += ((1 << PROB_BITS) - *prob) >> PROB_SHIFT;
+  }
+  else
+  {
+    enc->low += bound;
+    enc->range -= bound;
+    *prob -= *prob >> PROB_SHIFT;
+  }
+  while (enc->range < RANGE_TOP)
+  {
+    enc->range <<= 8;
+    shift_low(enc);
+  }
+}
+
+// Code the low 'nbits' of 'value' with probability 1/2 each
+//
+static void encode_direct(codec_encoder *enc, uint32_t value, int nbits)
+{
+  for (int i = nbits - 1; i >= 0; i--)
+  {
+    enc->range >>= 1;
+    if ((value >> i) & 1)
+    {
+      enc->low += enc->range;
+    }
+    while (enc->range < RANGE_TOP)
+    {
+      enc->range <<= 8;
+      shift_low(enc);
+    }
+  }
+}
+
+codec_encoder *codec_encoder_open(FILE *stream)
+{
+  codec_encoder *enc = (codec_encoder *)calloc(1, sizeof(codec_encoder));
+  enc->stream = stream;
+  enc->range = 0xFFFFFFFF;
+  enc->cache_size = 1;
+  model_init(&enc->model);
+  return enc;
+}
+
+int codec_encode(codec_encoder *enc, const trace_record *rec)
+{
+  codec_model *m = &enc->model;
+  uint32_t outcome = rec->flags & BR_OUTCOME;
+  uint8_t static_flags = rec->flags & STATIC_FLAGS;
+
+  // Which branch: the expected successor, a known branch, or a new one
+  uint32_t id = model_lookup(m, rec->pc);
+  uint32_t predicted = model_predicted_id(m);
+  uint32_t hit = (id != NO_ID && id == predicted);
+  if (predicted != NO_ID)
+  {
+    encode_bit(enc, &m->p_landing[landing_slot(m)], hit);
+  }
+  if (!hit)
+  {
+    encode_bit(enc, &m->p_known, id != NO_ID);
+    if (id != NO_ID)
+    {
+      encode_direct(enc, id, id_bits(m));
+    }
+    else
+    {
+      encode_direct(enc, rec->pc, 32);
+      encode_direct(enc, static_flags >> 1, 4);
+      id = model_add(m, rec->pc, static_flags);
+    }
+  }
+
+  // Static flags rarely change for a known branch
+  uint32_t same = (m->static_flags[id] == static_flags);
+  encode_bit(enc, &m->p_flags_same, same);
+  if (!same)
+  {
+    encode_direct(enc, static_flags >> 1, 4);
+    m->static_flags[id] = static_flags;
+  }
+
+  int ctx;
+  uint32_t expected = model_predict_outcome(m, id, &ctx);
+  encode_bit(enc, &m->p_outcome[ctx], outcome == expected);
+
+  uint32_t same_target = (rec->target == m->last_target[id]);
+  encode_bit(enc, &m->p_target[id], same_target);
+  if (!same_target)
+  {
+    // Returns usually go just past the call on top of the stack
+    uint32_t delta = rec->target - model_ras_top(m);
+    uint32_t ras_hit = (static_flags & BR_RET) && delta < (1 << RET_DELTA_BITS);
+    if (static_flags & BR_RET)
+    {
+      encode_bit(enc, &m->p_ras, ras_hit);
+    }
+    if (ras_hit)
+    {
+      encode_direct(enc, delta, RET_DELTA_BITS);
+    }
+    else
+    {
+      encode_direct(enc, rec->target, 32);
+    }
+  }
+
+  model_update(m, id, outcome, rec->target);
+  return !enc->failed;
+}
+
+int codec_encoder_close(codec_encoder *enc)
+{
+  for (int i = 0; i < 5; i++)
+  {
+    shift_low(enc);
+  }
+  if (enc->out_len > 0 && fwrite(enc->out, 1, enc->out_len, enc->stream) != enc->out_len)
+  {
+    enc->failed = 1;
+  }
+
+  int ok = !enc->failed;
+  model_free(&enc->model);
+  free(enc);
+  return ok;
+}
+
+//------------------------------------//
+//         Range Decoder              //
+//------------------------------------//
+
+struct codec_decoder
+{
+  const uint8_t *data;
+  const uint8_t *end;
+  uint32_t range;
+  uint32_t code;
+  uint64_t remaining;
+  codec_model model;
+};
+
+static inline uint8_t get_byte(codec_decoder *dec)
+{
+  return dec->data < dec->end ? *dec->data++ : 0;
+}
+
+static inline uint32_t decode_bit(codec_decoder *dec, uint16_t *prob)
+{
+  uint32_t bound = (dec->range >> PROB_BITS) * *prob;
+  uint32_t bit;
+  if (dec->code < bound)
+  {
+    dec->range = bound;
+    *prob += ((1 << PROB_BITS) - *prob) >> PROB_SHIFT;
+    bit = 0;
+  }
+  else
+  {
+    dec->code -= bound;
+    dec->range -= bound;
+    *prob -= *prob >> PROB_SHIFT;
+    bit = 1;
+  }
+  if (dec->range < RANGE_TOP)
+  {
+    dec->range <<= 8;
+    dec->code = (dec->code << 8) | get_byte(dec);
+  }
+  return bit;
+}
+
+static inline uint32_t decode_direct(codec_decoder *dec, int nbits)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < nbits; i++)
+  {
+    dec->range >>= 1;
+    uint32_t bit = (dec->code >= dec->range);
+    dec->code -= dec->range & (0 - bit);
+    value = (value << 1) | bit;
+    if (dec->range < RANGE_TOP)
+    {
+      dec->range <<= 8;
+      dec->code = (dec->code << 8) | get_byte(dec);
+    }
+  }
+  return value;
+}
+
+codec_decoder *codec_decoder_open(const uint8_t *data, size_t size, uint64_t num_records)
+{
+  codec_decoder *dec = (codec_decoder *)calloc(1, sizeof(codec_decoder));
+  dec->data = data;
+  dec->end = data + size;
+  dec->range = 0xFFFFFFFF;
+  dec->remaining = num_records;
+  for (int i = 0; i < 5; i++)
+  {
+    dec->code = (dec->code << 8) | get_byte(dec);
+  }
+  model_init(&dec->model);
+  return dec;
+}
+
+int codec_decode(codec_decoder *dec, trace_record *rec)
+{
+  if (dec->remaining == 0)
+  {
+    return 0;
+  }
+  dec->remaining--;
+
+  codec_model *m = &dec->model;
+  uint32_t id = model_predicted_id(m);
+  uint32_t hit = (id != NO_ID) && decode_bit(dec, &m->p_landing[landing_slot(m)]);
+  if (!hit && decode_bit(dec, &m->p_known))
+  {
+    id = decode_direct(dec, id_bits(m));
+    if (id >= m->num_ids)
+    {
+      dec->remaining = 0;
+      return 0;
+    }
+  }
+  else if (!hit)
+  {
+    uint32_t pc = decode_direct(dec, 32);
+    id = model_add(m, pc, decode_direct(dec, 4) << 1);
+  }
+
+  if (!decode_bit(dec, &m->p_flags_same))
+  {
+    m->static_flags[id] = decode_direct(dec, 4) << 1;
+  }
+  uint8_t static_flags = m->static_flags[id];
+
+  int ctx;
+  uint32_t expected = model_predict_outcome(m, id, &ctx);
+  uint32_t outcome = decode_bit(dec, &m->p_outcome[ctx]) ? expected : !expected;
+
+  uint32_t target = m->last_target[id];
+  if (!decode_bit(dec, &m->p_target[id]))
+  {
+    if ((static_flags & BR_RET) && decode_bit(dec, &m->p_ras))
+    {
+      target = model_ras_top(m) + decode_direct(dec, RET_DELTA_BITS);
+    }
+    else
+    {
+      target = decode_direct(dec, 32);
+    }
+  }
+
+  rec->pc = m->pcs[id];
+  rec->target = target;
+  rec->flags = static_flags | outcome;
+
+  model_update(m, id, outcome, target);
+  return 1;
+}
+
+void codec_decoder_close(codec_decoder *dec)
+{
+  model_free(&dec->model);
+  free(dec);
+}
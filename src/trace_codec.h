@@ -0,0 +1,46 @@
+//========================================================//
+//  trace_codec.h                                         //
+//  Header file for the predictor-coded trace format      //
+//                                                        //
+//  Every branch is coded relative to what a small model  //
+//  of the trace expects, and the resulting (mostly       //
+//  "as expected") bits are range coded                   //
+//========================================================//
+
+#ifndef TRACE_CODEC_H
+#define TRACE_CODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "trace.h"
+
+#define CODEC_MAGIC "BPCODEC"
+#define CODEC_VERSION 1
+
+typedef struct codec_encoder codec_encoder;
+typedef struct codec_decoder codec_decoder;
+
+// Encode records into 'stream', which is left positioned after the
+// coded bytes by codec_encoder_close
+//
+codec_encoder *codec_encoder_open(FILE *stream);
+
+int codec_encode(codec_encoder *enc, const trace_record *rec);
+
+// Flush the coder and free 'enc'
+//
+// Returns True if every byte was written
+//
+int codec_encoder_close(codec_encoder *enc);
+
+// Decode 'num_records' records from the coded bytes data[0, size)
+//
+codec_decoder *codec_decoder_open(const uint8_t *data, size_t size, uint64_t num_records);
+
+// Returns True if Successful
+//
+int codec_decode(codec_decoder *dec, trace_record *rec);
+
+void codec_decoder_close(codec_decoder *dec);
+
+#endif
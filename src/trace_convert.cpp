@@ -0,0 +1,117 @@
+//========================================================//
+//  trace_convert.cpp                                     //
+//  Converts branch traces to the packed binary or the    //
+//  predictor-coded trace format read by the predictor    //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "trace.h"
+
+// Print out the Usage information to stderr
+//
+void usage()
+{
+  fprintf(stderr, "Usage: trace_convert [--codec] <input> <output>\n");
+  fprintf(stderr, "       trace_convert --index[=<n>] <trace>\n");
+  fprintf(stderr, "       bunzip2 -kc trace.bz2 | trace_convert - <output>\n");
+  fprintf(stderr, " Reads a trace in any supported format ('-' for text on stdin)\n");
+  fprintf(stderr, " and writes it as a packed binary trace, or with --codec as a\n");
+  fprintf(stderr, " compact predictor-coded trace.\n");
+  fprintf(stderr, " With --index, writes the index of a text, bzip2 or binary trace\n");
+  fprintf(stderr, " with an entry every n (default %d) conditional branches, used by\n", INDEX_INTERVAL);
+  fprintf(stderr, " predictor --skip.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int format = TRACE_BINARY;
+  uint64_t interval = 0;
+  const char *paths[2];
+  int num_paths = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage();
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--codec"))
+    {
+      format = TRACE_CODEC;
+    }
+    else if (!strcmp(argv[i], "--index"))
+    {
+      interval = INDEX_INTERVAL;
+    }
+    else if (!strncmp(argv[i], "--index=", 8) && strtoull(argv[i] + 8, NULL, 0) > 0)
+    {
+      interval = strtoull(argv[i] + 8, NULL, 0);
+    }
+    else if (num_paths < 2 && (strncmp(argv[i], "--", 2) || !strcmp(argv[i], "-")))
+    {
+      paths[num_paths++] = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (interval > 0 && num_paths == 1 && strcmp(paths[0], "-"))
+  {
+    if (!trace_build_index(paths[0], interval))
+    {
+      fprintf(stderr, "Unable to index trace %s: %s\n", paths[0], strerror(errno));
+      exit(1);
+    }
+    char *index_path = trace_index_path(paths[0]);
+    printf("Wrote %s\n", index_path);
+    free(index_path);
+    return 0;
+  }
+  if (num_paths != 2 || interval > 0)
+  {
+    usage();
+    exit(1);
+  }
+
+  trace_reader *reader = trace_open(paths[0]);
+  if (reader == NULL)
+  {
+    fprintf(stderr, "Unable to open trace %s: %s\n", paths[0], strerror(errno));
+    exit(1);
+  }
+
+  trace_writer *writer = trace_writer_open(paths[1], format);
+  if (writer == NULL)
+  {
+    fprintf(stderr, "Unable to create %s: %s\n", paths[1], strerror(errno));
+    exit(1);
+  }
+
+  uint64_t num_records = 0;
+  trace_record rec;
+  while (trace_next(reader, &rec))
+  {
+    if (!trace_write(writer, &rec))
+    {
+      break;
+    }
+    num_records++;
+  }
+  trace_close(reader);
+
+  if (!trace_writer_close(writer))
+  {
+    fprintf(stderr, "Failed writing %s: %s\n", paths[1], strerror(errno));
+    exit(1);
+  }
+
+  printf("Records:         %10llu\n", (unsigned long long)num_records);
+
+  return 0;
+}
@@ -0,0 +1,287 @@
+//========================================================//
+//  trace_parse.cpp                                       //
+//  Source file for the block parser of text traces       //
+//                                                        //
+//  Delimiters are located 64 bytes at a time with SIMD   //
+//  byte compares and the hex fields are decoded without  //
+//  branches, replacing one sscanf call per line          //
+//========================================================//
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+//------------------------------------//
+//        Delimiter Scanners          //
+//------------------------------------//
+
+// Set bit i of '*delims' for every tab or newline in p[0, 64) and
+// bit i of '*newlines' for every newline
+//
+typedef void (*delim_scanner)(const char *p, uint64_t *delims, uint64_t *newlines);
+
+static void scan_delims_scalar(const char *p, uint64_t *delims, uint64_t *newlines)
+{
+  uint64_t d = 0, n = 0;
+  for (int i = 0; i < 64; i++)
+  {
+    uint64_t is_nl = (p[i] == '\n');
+    uint64_t is_tab = (p[i] == '\t');
+    d |= (is_nl | is_tab) << i;
+    n |= is_nl << i;
+  }
+  *delims = d;
+  *newlines = n;
+}
+
+#ifdef __SSE2__
+static void scan_delims_sse2(const char *p, uint64_t *delims, uint64_t *newlines)
+{
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  uint64_t d = 0, n = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    __m128i is_nl = _mm_cmpeq_epi8(v, nl);
+    __m128i is_tab = _mm_cmpeq_epi8(v, tab);
+    d |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(is_nl, is_tab)) << (16 * i);
+    n |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_nl) << (16 * i);
+  }
+  *delims = d;
+  *newlines = n;
+}
+
+__attribute__((target("avx2"))) static void scan_delims_avx2(const char *p, uint64_t *delims, uint64_t *newlines)
+{
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+  __m256i lo_nl = _mm256_cmpeq_epi8(lo, nl);
+  __m256i hi_nl = _mm256_cmpeq_epi8(hi, nl);
+  __m256i lo_d = _mm256_or_si256(lo_nl, _mm256_cmpeq_epi8(lo, tab));
+  __m256i hi_d = _mm256_or_si256(hi_nl, _mm256_cmpeq_epi8(hi, tab));
+  *delims = (uint64_t)(uint32_t)_mm256_movemask_epi8(lo_d) |
+            ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi_d) << 32);
+  *newlines = (uint64_t)(uint32_t)_mm256_movemask_epi8(lo_nl) |
+              ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi_nl) << 32);
+}
+#endif
+
+int traceParser = -1;
+
+static int detect_parser()
+{
+#ifdef __SSE2__
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? PARSER_AVX2 : PARSER_SSE2;
+#else
+  return PARSER_SCALAR;
+#endif
+}
+
+// The widest scanner the CPU supports, detected once (a local static
+// is initialized once even when threads race to it); the scanners are
+// ordered so that every narrower one is supported too
+//
+static int widest_parser()
+{
+  static const int widest = detect_parser();
+  return widest;
+}
+
+int trace_parser_supported(int parser)
+{
+  return parser >= PARSER_SCALAR && parser <= widest_parser();
+}
+
+// The scanner of traceParser, or the widest supported one when it is
+// unset or unsupported. traceParser is only read, as the blocks of a
+// bzip2 trace are parsed on several threads at once.
+//
+static delim_scanner pick_scanner()
+{
+  int parser = traceParser;
+  if (!trace_parser_supported(parser))
+  {
+    parser = widest_parser();
+  }
+
+  switch (parser)
+  {
+#ifdef __SSE2__
+  case PARSER_AVX2:
+    return scan_delims_avx2;
+  case PARSER_SSE2:
+    return scan_delims_sse2;
+#endif
+  default:
+    return scan_delims_scalar;
+  }
+}
+
+//------------------------------------//
+//          Field Decoding            //
+//------------------------------------//
+
+// Decode the 1-8 hex digits at p[0, len). Each byte becomes its
+// nibble value, the digits beyond 'len' are shifted out and the
+// nibbles are packed pairwise into the 32-bit result.
+//
+static inline uint32_t decode_hex(const char *p, size_t len)
+{
+  uint64_t x;
+  memcpy(&x, p, 8);
+  x = (x & 0x0F0F0F0F0F0F0F0FULL) + 9 * ((x >> 6) & 0x0101010101010101ULL);
+  x <<= 8 * (8 - len);
+  x = __builtin_bswap64(x);
+  x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+  x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+  x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+  return (uint32_t)x;
+}
+
+// True if p[0, len) is "0x" followed by 1-8 hex digits
+//
+static inline int is_hex_field(const char *p, size_t len)
+{
+  if (len < 3 || len > 10 || p[0] != '0' || p[1] != 'x')
+  {
+    return 0;
+  }
+  for (size_t i = 2; i < len; i++)
+  {
+    char c = p[i] | 0x20;
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Decode one line from its 7 field ends (6 tabs and the newline)
+//
+// Returns True if the line has the canonical shape
+//
+static inline int decode_line(const char *line, const char *const *ends, trace_record *rec)
+{
+  const char *target = ends[0] + 1;
+  size_t pc_len = ends[0] - line;
+  size_t target_len = ends[1] - target;
+
+  // Flag fields are single digits
+  uint32_t flags = 0;
+  for (int f = 0; f < 5; f++)
+  {
+    const char *field = ends[f + 1] + 1;
+    if (ends[f + 2] - field != 1 || (unsigned)(field[0] - '0') > 9)
+    {
+      return 0;
+    }
+    flags |= (uint32_t)(field[0] != '0') << f;
+  }
+
+  if (!is_hex_field(line, pc_len) || !is_hex_field(target, target_len))
+  {
+    return 0;
+  }
+
+  rec->pc = decode_hex(line + 2, pc_len - 2);
+  rec->target = decode_hex(target + 2, target_len - 2);
+  rec->flags = flags;
+  return 1;
+}
+
+// Parse an odd-shaped line with the reference sscanf parser, on a
+// terminated copy (on the heap for long lines)
+//
+static int parse_line_scalar(const char *line, const char *end, trace_record *rec)
+{
+  char tmp[256];
+  size_t len = end - line;
+  char *copy = (len < sizeof(tmp)) ? tmp : (char *)malloc(len + 1);
+  if (copy == NULL)
+  {
+    return 0;
+  }
+  memcpy(copy, line, len);
+  copy[len] = '\0';
+  int ok = trace_parse_line(copy, rec);
+  if (copy != tmp)
+  {
+    free(copy);
+  }
+  return ok;
+}
+
+//------------------------------------//
+//           Block Parser             //
+//------------------------------------//
+
+size_t trace_parse_block(const char *text, size_t size, trace_record *records,
+                         size_t max_records, size_t *num_records)
+{
+  delim_scanner scan = pick_scanner();
+  const char *line = text;
+  const char *ends[7];
+  int num_ends = 0;
+  size_t n = 0;
+
+  for (size_t base = 0; base < size && n < max_records; base += 64)
+  {
+    uint64_t delims, newlines;
+    scan(text + base, &delims, &newlines);
+    if (size - base < 64)
+    {
+      uint64_t valid = (1ULL << (size - base)) - 1;
+      delims &= valid;
+      newlines &= valid;
+    }
+
+    while (delims != 0)
+    {
+      int bit = __builtin_ctzll(delims);
+      delims &= delims - 1;
+      const char *p = text + base + bit;
+
+      if (num_ends < 7)
+      {
+        ends[num_ends] = p;
+      }
+      num_ends++;
+
+      if (!((newlines >> bit) & 1))
+      {
+        continue;
+      }
+
+      // End of a line
+      if (num_ends != 7 || !decode_line(line, ends, &records[n]))
+      {
+        if (parse_line_scalar(line, p, &records[n]))
+        {
+          n++;
+        }
+      }
+      else
+      {
+        n++;
+      }
+      line = p + 1;
+      num_ends = 0;
+
+      if (n == max_records)
+      {
+        break;
+      }
+    }
+  }
+
+  *num_records = n;
+  return line - text;
+}